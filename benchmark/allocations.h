@@ -0,0 +1,137 @@
+#pragma once
+#include "../dvector/dvector.h"
+#include "../test/dbgalloc.h"
+#include "benchmark.h"
+#include "workloads.h"
+#include <array>
+#include <deque>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+namespace bm
+{
+    /*
+        Allocation profile of the workload matrix, with --allocations. Each
+        workload of workloads.h runs once on dvector, std::vector and std::deque
+        built on the test suite's DbgAlloc, and reports allocations and bytes
+        per operation, the peak of live bytes, and how many of the allocations
+        were leaves, inner nodes, element arrays or else. Tasks are named
+        alloc/<workload>/<type>/<container>/<size>.
+
+        Only the container's allocator is counted: the characters of a long
+        std::string element come from its own. rope is left out, its
+        allocator does not reach all of its nodes.
+     */
+    template<class T> struct is_dleaf : std::false_type {};
+    template<class T, class A, class C, class O> struct is_dleaf<dv::dleaf<T, A, C, O>> : std::true_type {};
+
+    inline std::array<size_t, 4> & allocation_kinds()
+    {
+        // Counts by AllocationResult::kind_names, since the last reset
+        static std::array<size_t, 4> instance;
+        return instance;
+    }
+
+    template<class T, class Element = T>
+    class CountingAlloc : public dbgalloc::DbgAlloc<T>
+    {
+        // DbgAlloc, also counting allocations by what is allocated; rebound copies remember the container's Element
+    public:
+        template<class U> struct rebind { typedef CountingAlloc<U, Element> other; };
+
+        CountingAlloc() {}
+
+        template<class U>
+        CountingAlloc(const CountingAlloc<U, Element> &) {}
+
+        [[nodiscard]] T * allocate(size_t cnt)
+        {
+            auto p = dbgalloc::DbgAlloc<T>::allocate(cnt);
+            if constexpr (is_dleaf<T>::value)
+            {
+                allocation_kinds()[0]++;
+            }
+            else if constexpr (std::is_base_of_v<dv::dnode, T>)
+            {
+                allocation_kinds()[1]++;
+            }
+            else if constexpr (std::is_same_v<T, Element>)
+            {
+                allocation_kinds()[2]++;
+            }
+            else
+            {
+                allocation_kinds()[3]++;
+            }
+            return p;
+        }
+    };
+
+    template<typename T, typename U, typename E>
+    constexpr bool operator== (const CountingAlloc<T, E> &, const CountingAlloc<U, E> &) noexcept
+    {
+        return true;
+    }
+
+    template<typename T, typename U, typename E>
+    constexpr bool operator!= (const CountingAlloc<T, E> &, const CountingAlloc<U, E> &) noexcept
+    {
+        return false;
+    }
+
+    template<class Run>
+    AllocationResult count_allocations(const std::string & name, const size_t items, Run run)
+    {
+        // What run() allocates through CountingAlloc, and the bytes live before, at most and after
+        dbgalloc::reset_counts();
+        allocation_kinds().fill(0);
+
+        AllocationResult r;
+        r.task = name;
+        r.items = items;
+        r.start_live_bytes = dbgalloc::live_bytes;
+        run();
+        r.count = dbgalloc::alloc_count;
+        r.bytes = dbgalloc::alloc_bytes;
+        r.peak_live_bytes = dbgalloc::peak_bytes;
+        r.end_live_bytes = dbgalloc::live_bytes;
+        std::copy(allocation_kinds().begin(), allocation_kinds().end(), r.kinds);
+        return r;
+    }
+
+    template<class C, class T>
+    void profile_workload(const std::string & container, const std::string & type, const workload w, const size_t size)
+    {
+        std::string name = std::string("alloc/") + workload_name(w) + "/" + type + "/" + container + "/" + std::to_string(size);
+        if (workload_skipped<C, T>(w, size) || !selected({ name }))
+        {
+            return;
+        }
+        workload_run<C, T> run(w, size);
+        std::cout << report_allocations(count_allocations(name, run.items, run.task));
+    }
+
+    template<class T>
+    void run_allocation_profile(const std::string & type)
+    {
+        using A = CountingAlloc<T>;
+        for (size_t size = 1000; size <= options().max_size; size *= 100)
+        {
+            for (auto w : { workload::append, workload::queue, workload::zipf_edits,
+                workload::clustered_edits, workload::read_heavy, workload::scan })
+            {
+                profile_workload<dv::dvector<T, A>, T>("dvector", type, w, size);
+                profile_workload<std::vector<T, A>, T>("vector", type, w, size);
+                profile_workload<std::deque<T, A>, T>("deque", type, w, size);
+            }
+        }
+    }
+
+    inline void run_allocation_profile()
+    {
+        run_allocation_profile<int>("int");
+        run_allocation_profile<pod64>("pod64");
+        run_allocation_profile<std::string>("string");
+    }
+}
@@ -1,113 +1,589 @@
 #pragma once
 #include <functional>
 #include <iostream>
+#include <fstream>
 #include <string>
 #include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
 #include <vector>
 #include <chrono>
 #include <algorithm>
 #include <numeric>
 #include <sstream>
+#include <iomanip>
+#include <regex>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
 
 namespace bm
 {
+    /*
+        Optimization barriers. do_not_optimize(x) makes the compiler believe `x`
+        is read, so the computation of `x` is kept; clobber_memory() makes it
+        believe all memory is read and written, so pending stores are kept.
+     */
+#if defined(_MSC_VER)
+    template<class T>
+    inline void do_not_optimize(const T & value)
+    {
+        static const void * volatile sink;
+        sink = &value;
+        _ReadWriteBarrier();
+    }
+
+    inline void clobber_memory()
+    {
+        _ReadWriteBarrier();
+    }
+#else
+    template<class T>
+    inline void do_not_optimize(const T & value)
+    {
+        asm volatile("" : : "r,m"(value) : "memory");
+    }
+
+    inline void clobber_memory()
+    {
+        asm volatile("" : : : "memory");
+    }
+#endif
+
+    struct Options
+    {
+        std::string filter; // ECMAScript regex, only the tasks whose name it matches (anywhere) run
+        int repetitions = 5; // Timed samples per task
+        int warmup = 1; // Untimed runs before them
+        double min_time = 0.05; // Seconds a sample lasts at least, short tasks run several times per sample
+        std::string json; // File the results of all tasks are written to, as one JSON document
+        size_t max_size = 100000; // Largest container the workload matrix sweeps to
+        bool allocations = false; // Count allocations instead of timing, only the alloc/ tasks run
+        uint64_t seed = 0; // Of the random operations the latency tasks time
+
+        static constexpr const char * usage =
+            "usage: benchmark [--filter=<regex>] [--repetitions=<n>] [--warmup=<n>] [--min-time=<seconds>] [--json=<file>] [--max-size=<n>] [--allocations] [--seed=<n>]\n";
+
+        bool parse(int argc, char ** argv)
+        {
+            // False on an argument it does not know or a malformed value
+            for (int i = 1; i < argc; i++)
+            {
+                std::string arg = argv[i];
+                auto eq = arg.find('=');
+                std::string key = arg.substr(0, eq);
+                std::string value = eq == std::string::npos ? "" : arg.substr(eq + 1);
+                char * end = nullptr;
+                if (arg == "--allocations")
+                {
+                    allocations = true;
+                }
+                else if (eq == std::string::npos || value.empty())
+                {
+                    return false;
+                }
+                else if (key == "--filter")
+                {
+                    try
+                    {
+                        std::regex check(value);
+                    }
+                    catch (const std::regex_error &)
+                    {
+                        return false;
+                    }
+                    filter = value;
+                }
+                else if (key == "--repetitions")
+                {
+                    repetitions = static_cast<int>(std::strtol(value.c_str(), &end, 10));
+                }
+                else if (key == "--warmup")
+                {
+                    warmup = static_cast<int>(std::strtol(value.c_str(), &end, 10));
+                }
+                else if (key == "--min-time")
+                {
+                    min_time = std::strtod(value.c_str(), &end);
+                }
+                else if (key == "--json")
+                {
+                    json = value;
+                }
+                else if (key == "--max-size")
+                {
+                    max_size = static_cast<size_t>(std::strtoull(value.c_str(), &end, 10));
+                }
+                else if (key == "--seed")
+                {
+                    seed = static_cast<uint64_t>(std::strtoull(value.c_str(), &end, 10));
+                }
+                else
+                {
+                    return false;
+                }
+                if (end != nullptr && (*end != '\0' || repetitions < 1 || warmup < 0 || min_time < 0))
+                {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        bool selected(const std::string & name) const
+        {
+            if (allocations != (name.compare(0, 6, "alloc/") == 0))
+            {
+                return false;
+            }
+            return filter.empty() || std::regex_search(name, std::regex(filter));
+        }
+    };
+
+    inline Options & options()
+    {
+        // Set once from the command line, see Options::parse
+        static Options instance;
+        return instance;
+    }
+
+    inline bool selected(std::initializer_list<std::string> names)
+    {
+        // For measurements made outside of Benchmark, and setups shared by tasks, so the filter covers them too
+        return std::any_of(names.begin(), names.end(), [](const std::string & name) { return options().selected(name); });
+    }
+
+    inline double percentile(const std::vector<double> & sorted, const double p)
+    {
+        // Nearest rank: with few samples the high percentiles are the slowest sample
+        size_t rank = static_cast<size_t>(std::ceil(p / 100 * sorted.size()));
+        return sorted[std::min(sorted.size(), std::max<size_t>(rank, 1)) - 1];
+    }
+
+    inline std::string json_string(const std::string & s)
+    {
+        std::stringstream out;
+        out << '"';
+        for (unsigned char c : s)
+        {
+            if (c == '"' || c == '\\')
+            {
+                out << '\\' << c;
+            }
+            else if (c < 0x20)
+            {
+                out << "\\u" << std::hex << std::setw(4) << std::setfill('0') << static_cast<int>(c) << std::dec;
+            }
+            else
+            {
+                out << c;
+            }
+        }
+        out << '"';
+        return out.str();
+    }
+
+    struct TaskResult
+    {
+        // Times are in nanoseconds per run of the task
+        std::string task;
+        size_t iterations = 0; // Runs per sample
+        size_t items = 0; // Operations a run makes, when the task counts them
+        std::vector<double> samples;
+        double min = 0;
+        double mean = 0;
+        double median = 0;
+        double p90 = 0;
+        double p99 = 0;
+        double max = 0;
+        double stddev = 0;
+
+        void summarize()
+        {
+            std::vector<double> sorted = samples;
+            std::sort(sorted.begin(), sorted.end());
+            min = sorted.front();
+            max = sorted.back();
+            mean = std::accumulate(sorted.begin(), sorted.end(), 0.0) / sorted.size();
+            median = sorted.size() % 2 == 1 ? sorted[sorted.size() / 2] :
+                (sorted[sorted.size() / 2 - 1] + sorted[sorted.size() / 2]) / 2;
+            p90 = percentile(sorted, 90);
+            p99 = percentile(sorted, 99);
+            double squares = 0;
+            for (auto s : sorted)
+            {
+                squares += (s - mean) * (s - mean);
+            }
+            stddev = sorted.size() > 1 ? std::sqrt(squares / (sorted.size() - 1)) : 0;
+        }
+
+        std::string to_json() const
+        {
+            std::stringstream s;
+            s << std::setprecision(10);
+            s << "{ \"task\": " << json_string(task) << ", \"iterations\": " << iterations <<
+                ", \"items\": " << items <<
+                ", \"repetitions\": " << samples.size() <<
+                ", \"min_ns\": " << min << ", \"mean_ns\": " << mean << ", \"median_ns\": " << median <<
+                ", \"p90_ns\": " << p90 << ", \"p99_ns\": " << p99 << ", \"max_ns\": " << max <<
+                ", \"stddev_ns\": " << stddev << ", \"samples_ns\": [";
+            for (size_t i = 0; i < samples.size(); i++)
+            {
+                s << (i > 0 ? ", " : "") << samples[i];
+            }
+            s << "] }";
+            return s.str();
+        }
+    };
+
+    inline std::vector<TaskResult> & results()
+    {
+        // Every task run so far, for write_json
+        static std::vector<TaskResult> instance;
+        return instance;
+    }
+
+    class Histogram
+    {
+        /*
+            Latencies in nanoseconds, in log-linear buckets like HdrHistogram's:
+            exact below 2^precision, then 2^precision buckets per doubling, so a
+            reported value is within 1% of the recorded one. Fixed size, recording
+            is a few shifts and an increment.
+         */
+        static constexpr int precision = 7;
+        static constexpr uint64_t sub_buckets = uint64_t(1) << precision;
+
+        std::vector<uint64_t> counts = std::vector<uint64_t>((64 - precision + 1) * sub_buckets);
+        uint64_t total = 0;
+        uint64_t largest = 0;
+        double sum = 0;
+
+        static size_t _index(const uint64_t value) noexcept
+        {
+            int shift = 0;
+            while ((value >> shift) >= 2 * sub_buckets)
+            {
+                shift += 1;
+            }
+            return static_cast<size_t>((shift + 1) * sub_buckets + (value >> shift) - sub_buckets);
+        }
+
+        static uint64_t _lowest(const size_t index) noexcept
+        {
+            if (index < sub_buckets)
+            {
+                return index;
+            }
+            size_t shift = index / sub_buckets - 1;
+            return (index % sub_buckets + sub_buckets) << shift;
+        }
+    public:
+        void record(const uint64_t nanoseconds) noexcept
+        {
+            counts[_index(nanoseconds)] += 1;
+            total += 1;
+            largest = std::max(largest, nanoseconds);
+            sum += static_cast<double>(nanoseconds);
+        }
+
+        uint64_t count() const noexcept { return total; }
+        uint64_t max() const noexcept { return largest; }
+        double mean() const noexcept { return total > 0 ? sum / total : 0; }
+
+        uint64_t percentile(const double p) const noexcept
+        {
+            // The highest value of the bucket holding the nearest rank
+            uint64_t rank = std::max<uint64_t>(1, static_cast<uint64_t>(std::ceil(p / 100 * total)));
+            uint64_t seen = 0;
+            for (size_t i = 0; i < counts.size(); i++)
+            {
+                seen += counts[i];
+                if (seen >= rank)
+                {
+                    return std::min(largest, _lowest(i + 1) - 1);
+                }
+            }
+            return largest;
+        }
+    };
+
+    struct LatencyResult
+    {
+        std::string task;
+        uint64_t count = 0;
+        uint64_t p50 = 0;
+        uint64_t p99 = 0;
+        uint64_t p999 = 0;
+        uint64_t max = 0;
+        double mean = 0;
+        uint64_t clock_overhead = 0; // Included in every time above, see latency.h
+        uint64_t seed = 0;
+
+        LatencyResult(const std::string & name, const Histogram & h, const uint64_t clock_overhead, const uint64_t seed)
+            : task(name), count(h.count()), p50(h.percentile(50)), p99(h.percentile(99)),
+            p999(h.percentile(99.9)), max(h.max()), mean(h.mean()), clock_overhead(clock_overhead), seed(seed)
+        {
+        }
+
+        std::string to_string() const
+        {
+            std::stringstream s;
+            s << std::left << std::setw(40) << task << std::right <<
+                " p50 " << std::setw(8) << p50 << " ns  p99 " << std::setw(8) << p99 <<
+                " ns  p99.9 " << std::setw(9) << p999 << " ns  max " << std::setw(10) << max <<
+                " ns  (" << count << " ops, clock " << clock_overhead << " ns)" << std::endl;
+            return s.str();
+        }
+
+        std::string to_json() const
+        {
+            std::stringstream s;
+            s << "{ \"task\": " << json_string(task) << ", \"count\": " << count <<
+                ", \"p50_ns\": " << p50 << ", \"p99_ns\": " << p99 << ", \"p999_ns\": " << p999 <<
+                ", \"max_ns\": " << max << ", \"mean_ns\": " << mean << 
+                ", \"clock_overhead_ns\": " << clock_overhead << ", \"seed\": " << seed << " }";
+            return s.str();
+        }
+    };
+
+    inline std::vector<LatencyResult> & latency_results()
+    {
+        // Every latency measurement so far, for write_json
+        static std::vector<LatencyResult> instance;
+        return instance;
+    }
+
+    inline std::string report_latency(const std::string & name, const Histogram & h, const uint64_t clock_overhead)
+    {
+        latency_results().emplace_back(name, h, clock_overhead, options().seed);
+        return latency_results().back().to_string();
+    }
+
+    struct AllocationResult
+    {
+        /*
+            Allocations made by one run of a task, see allocations.h. `kinds`
+            splits the count into leaves, inner nodes, element arrays and the
+            rest (for a dvector, the blocks of its shared buffers).
+         */
+        std::string task;
+        size_t items = 0;
+        size_t count = 0;
+        size_t bytes = 0;
+        size_t start_live_bytes = 0; // Held by the container before the run
+        size_t peak_live_bytes = 0;
+        size_t end_live_bytes = 0; // And after it
+        size_t kinds[4] = {};
+
+        static constexpr const char * kind_names[4] = { "leaves", "nodes", "elements", "other" };
+
+        double per_item(const size_t n) const
+        {
+            return items > 0 ? static_cast<double>(n) / items : 0;
+        }
+
+        std::string to_string() const
+        {
+            std::stringstream s;
+            s << std::fixed << std::setprecision(3) << std::left << std::setw(40) << task << std::right <<
+                " " << std::setw(8) << per_item(count) << " allocs/op " << std::setw(10) << per_item(bytes) <<
+                " bytes/op  peak " << std::setw(11) << peak_live_bytes << " bytes (from " << start_live_bytes << 
+                " to " << end_live_bytes << ") ";
+            for (int k = 0; k < 4; k++)
+            {
+                s << " " << kind_names[k] << " " << per_item(kinds[k]);
+            }
+            s << std::endl;
+            return s.str();
+        }
+
+        std::string to_json() const
+        {
+            std::stringstream s;
+            s << "{ \"task\": " << json_string(task) << ", \"items\": " << items <<
+                ", \"allocations\": " << count << ", \"bytes\": " << bytes <<
+                ", \"allocations_per_item\": " << per_item(count) << ", \"bytes_per_item\": " << per_item(bytes) <<
+                ", \"start_live_bytes\": " << start_live_bytes << ", \"peak_live_bytes\": " << peak_live_bytes <<
+                ", \"end_live_bytes\": " << end_live_bytes;
+            for (int k = 0; k < 4; k++)
+            {
+                s << ", \"" << kind_names[k] << "\": " << kinds[k];
+            }
+            s << " }";
+            return s.str();
+        }
+    };
+
+    inline std::vector<AllocationResult> & allocation_results()
+    {
+        // Every allocation profile so far, for write_json
+        static std::vector<AllocationResult> instance;
+        return instance;
+    }
+
+    inline std::string report_allocations(const AllocationResult & r)
+    {
+        allocation_results().push_back(r);
+        return r.to_string();
+    }
+
+    template<class Items>
+    void _write_json_array(std::ostream & out, const char * key, const Items & items)
+    {
+        out << "  \"" << key << "\": [";
+        for (size_t i = 0; i < items.size(); i++)
+        {
+            out << (i > 0 ? "," : "") << "\n    " << items[i].to_json();
+        }
+        out << "\n  ]";
+    }
+
+    inline bool write_json(const std::string & path)
+    {
+        std::ofstream out(path);
+        out << "{\n";
+        _write_json_array(out, "benchmarks", results());
+        out << ",\n";
+        _write_json_array(out, "latencies", latency_results());
+        out << ",\n";
+        _write_json_array(out, "allocations", allocation_results());
+        out << "\n}\n";
+        return static_cast<bool>(out);
+    }
+
     class Benchmark
     {
     public:
         using TaskType = std::function<void()>;
-        using Clock = std::chrono::high_resolution_clock;
+        using Clock = std::chrono::steady_clock;
 
         std::vector<std::string> task_names;
         std::vector<TaskType> tasks;
-        std::vector<std::string> filter;
+        std::vector<size_t> items; // Per task, see per_run
+        std::vector<TaskType> setups; // Per task, see setup
 
         struct RunResult
         {
-            std::vector<std::string> task_names;
-            std::vector<bool> ran;
-            size_t repeat;
-            std::vector<double> best;
-            std::vector<double> avg;
+            std::vector<TaskResult> tasks; // Only those the filter selected
 
-            std::string to_string()
+            std::string to_string() const
             {
+                // One line per task, in milliseconds
                 std::stringstream s;
-
-                for (size_t i = 0; i < task_names.size(); i++)
+                s << std::fixed << std::setprecision(4);
+                for (const auto & r : tasks)
                 {
-                    s << "{ ";
-                    s << "\"task\": \"" << task_names[i] << "\", ";
-                    s << "\"ran\": " << ran[i] << ", ";
-                    s << "\"repeat\": " << repeat << ", ";
-                    s << "\"best\": " << best[i] << ", ";
-                    s << "\"avg\": " << avg[i];
-                    s << " }" << std::endl;
+                    s << std::left << std::setw(40) << r.task << std::right <<
+                        " median " << std::setw(11) << r.median / 1e6 << " ms" <<
+                        "  p90 " << std::setw(11) << r.p90 / 1e6 << " ms" <<
+                        "  min " << std::setw(11) << r.min / 1e6 << " ms" <<
+                        "  stddev " << std::setw(9) << r.stddev / 1e6 << " ms" <<
+                        "  (" << r.samples.size() << " x " << r.iterations << ")";
+                    if (r.items > 0)
+                    {
+                        s << "  " << std::setprecision(1) << r.median / r.items << " ns/op" << std::setprecision(4);
+                    }
+                    s << std::endl;
                 }
-
                 return s.str();
             }
         };
 
-        Benchmark(std::initializer_list<std::string> task_names, 
-            std::initializer_list<TaskType> tasks,
-            std::initializer_list<std::string> filter = {})
-            : task_names(std::move(task_names)), tasks(std::move(tasks)), filter(std::move(filter))
+        Benchmark(std::initializer_list<std::string> task_names, std::initializer_list<TaskType> tasks)
+            : task_names(task_names), tasks(tasks)
         {
-            assert(task_names.size() == tasks.size());
+            assert(this->task_names.size() == this->tasks.size());
         }
 
-        RunResult run(int repeat = 3)
+        Benchmark & per_run(std::initializer_list<size_t> operations)
         {
-            size_t index = 0;
-            RunResult result;
-            result.task_names = task_names;
-            result.repeat = repeat;
+            // How many operations a run of each task makes, so results also read per operation
+            items = operations;
+            assert(items.size() == tasks.size());
+            return *this;
+        }
+
+        Benchmark & setup(std::initializer_list<TaskType> before)
+        {
+            // Untimed work before every run of each task, such as building what the task tears down
+            setups = before;
+            assert(setups.size() == tasks.size());
+            return *this;
+        }
 
-            for (const auto & task : tasks)
+        RunResult run(const Options & opts = options())
+        {
+            /*
+                Per selected task: `warmup` untimed runs, then `repetitions` samples of
+                as many runs as make a sample last `min_time`, judged from one more
+                untimed run.
+             */
+            RunResult result;
+            for (size_t index = 0; index < tasks.size(); index++)
             {
-                bool skip = false;
-                for (const auto & name : filter)
+                if (!opts.selected(task_names[index]))
                 {
-                    if (name == task_names[index])
+                    continue;
+                }
+                const auto & task = tasks[index];
+                const TaskType before = index < setups.size() ? setups[index] : TaskType();
+                for (int i = 0; i < opts.warmup; i++)
+                {
+                    if (before)
                     {
-                        result.ran.push_back(false);
-                        result.avg.push_back(0);
-                        result.best.push_back(0);
-                        skip = true;
-                        break;
+                        before();
                     }
+                    task();
                 }
-                if (skip) continue;
-
-                result.ran.push_back(true);
-                std::vector<double> repeat_times;
-                for (int i = 0; i < repeat; i++)
+                double once = run_task(task, 1, before);
+                double wanted = opts.min_time * 1e9;
+                TaskResult r;
+                r.task = task_names[index];
+                r.items = index < items.size() ? items[index] : 0;
+                r.iterations = once >= wanted ? 1 : static_cast<size_t>(std::ceil(wanted / std::max(once, 1.0)));
+                for (int i = 0; i < opts.repetitions; i++)
                 {
-                    // std::cout << task_names[index] << " repeat: " << i << std::endl;
-                    repeat_times.push_back(run_task(task));
+                    r.samples.push_back(run_task(task, r.iterations, before));
                 }
-
-                result.best.push_back(*std::min_element(repeat_times.begin(), repeat_times.end()));
-                result.avg.push_back(std::accumulate(repeat_times.begin(), repeat_times.end(), 0.0) / repeat);
-
-                index += 1;
+                r.summarize();
+                results().push_back(r);
+                result.tasks.push_back(std::move(r));
             }
-
             return result;
         }
 
-        std::string get(int repeat = 3)
+        std::string get()
         {
-            return run(repeat).to_string();
+            return run().to_string();
         }
 
-        double run_task(const TaskType & task)
+        static double run_task(const TaskType & task, const size_t iterations, const TaskType & before = TaskType())
         {
+            // Nanoseconds per run, without the setup
+            if (before)
+            {
+                double total = 0;
+                for (size_t i = 0; i < iterations; i++)
+                {
+                    before();
+                    auto t1 = Clock::now();
+                    task();
+                    clobber_memory();
+                    total += std::chrono::duration<double, std::nano>(Clock::now() - t1).count();
+                }
+                return total / iterations;
+            }
             auto t1 = Clock::now();
-            task();
+            for (size_t i = 0; i < iterations; i++)
+            {
+                task();
+                clobber_memory();
+            }
             auto t2 = Clock::now();
-            return std::chrono::duration_cast<std::chrono::microseconds>(t2 - t1).count() * 1.0 / 10e3;
+            return std::chrono::duration<double, std::nano>(t2 - t1).count() / iterations;
         }
-
     };
-}
\ No newline at end of file
+}
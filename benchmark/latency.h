@@ -0,0 +1,171 @@
+#pragma once
+#include "../dvector/dvector.h"
+#include "benchmark.h"
+#include <chrono>
+#include <numeric>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace bm
+{
+    /*
+        Latency of single operations on a dvector<int>, each one timed on its
+        own into a Histogram, so that the rare slow ones show: rotations going
+        far up, splits of long leaves, compaction steps, deep copies. For every
+        size from 1000 up to Options::max_size by factors of 100, tasks
+        latency/<op>/<size>:
+
+            insert     at a random index, and
+            erase      at a random index, in phases of mostly one or the other
+            read       operator[] at a random index
+            step       ++ on an iterator, over whole scans
+            copy       copy construction of the whole dvector
+
+        The dvector starts as one leaf of `size` elements, which the first
+        inserts split, and compacts itself as the edits cut its leaves short.
+        Indices are drawn from Options::seed. Times include reading the clock
+        twice, clock_overhead(), which every LatencyResult records.
+     */
+    struct latency_policy : dv::default_policy
+    {
+        static constexpr size_t auto_compact = 256;
+    };
+
+    using LatencyClock = std::chrono::steady_clock;
+
+    inline uint64_t elapsed_ns(const LatencyClock::time_point t1, const LatencyClock::time_point t2)
+    {
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(t2 - t1).count());
+    }
+
+    inline uint64_t clock_overhead()
+    {
+        // Median of back to back clock readings
+        Histogram h;
+        for (int i = 0; i < 100000; i++)
+        {
+            auto t1 = LatencyClock::now();
+            auto t2 = LatencyClock::now();
+            h.record(elapsed_ns(t1, t2));
+        }
+        return h.percentile(50);
+    }
+
+    inline bool latency_selected(const size_t size)
+    {
+        const std::string suffix = "/" + std::to_string(size);
+        return selected({ "latency/insert" + suffix, "latency/erase" + suffix, "latency/read" + suffix,
+            "latency/step" + suffix, "latency/copy" + suffix });
+    }
+
+    inline void run_latency(const size_t size, const uint64_t overhead)
+    {
+        const std::string suffix = "/" + std::to_string(size);
+        if (!latency_selected(size))
+        {
+            return;
+        }
+
+        using Latency = dv::dvector<int, std::allocator<int>, latency_policy>;
+        std::vector<int> elements(size);
+        std::iota(elements.begin(), elements.end(), 0);
+        Latency d(std::move(elements));
+        std::mt19937_64 e(options().seed);
+        const size_t ops = 200000;
+
+        if (selected({ "latency/insert" + suffix, "latency/erase" + suffix }))
+        {
+            Histogram insert, erase;
+            for (size_t i = 0; i < ops; i++)
+            {
+                // Four phases of 3 inserts to 1 erase, then the reverse: the size grows by ops / 8 and comes back
+                bool growing = i / (ops / 4) % 2 == 0;
+                if (d.size() == 0 || (e() % 4 != 0) == growing)
+                {
+                    size_t index = e() % (d.size() + 1);
+                    auto t1 = LatencyClock::now();
+                    d.insert(index, static_cast<int>(i));
+                    auto t2 = LatencyClock::now();
+                    insert.record(elapsed_ns(t1, t2));
+                }
+                else
+                {
+                    size_t index = e() % d.size();
+                    auto t1 = LatencyClock::now();
+                    d.erase(index);
+                    auto t2 = LatencyClock::now();
+                    erase.record(elapsed_ns(t1, t2));
+                }
+            }
+            std::cout << report_latency("latency/insert" + suffix, insert, overhead) << 
+                report_latency("latency/erase" + suffix, erase, overhead);
+        }
+
+        if (selected({ "latency/read" + suffix }))
+        {
+            Histogram read;
+            for (size_t i = 0; i < ops; i++)
+            {
+                size_t index = e() % d.size();
+                auto t1 = LatencyClock::now();
+                do_not_optimize(d[index]);
+                auto t2 = LatencyClock::now();
+                read.record(elapsed_ns(t1, t2));
+            }
+            std::cout << report_latency("latency/read" + suffix, read, overhead);
+        }
+
+        if (selected({ "latency/step" + suffix }))
+        {
+            Histogram step;
+            while (step.count() < ops)
+            {
+                auto it = d.begin();
+                auto end = d.end();
+                while (it != end)
+                {
+                    auto t1 = LatencyClock::now();
+                    ++it;
+                    auto t2 = LatencyClock::now();
+                    step.record(elapsed_ns(t1, t2));
+                    if (it != end) do_not_optimize(*it);
+                }
+            }
+            std::cout << report_latency("latency/step" + suffix, step, overhead);
+        }
+
+        if (selected({ "latency/copy" + suffix }))
+        {
+            Histogram copy;
+            for (int i = 0; i < 100; i++)
+            {
+                auto t1 = LatencyClock::now();
+                Latency copied(d);
+                auto t2 = LatencyClock::now();
+                copy.record(elapsed_ns(t1, t2));
+                do_not_optimize(copied);
+            }
+            std::cout << report_latency("latency/copy" + suffix, copy, overhead);
+        }
+    }
+
+    inline void run_latency_suite()
+    {
+        bool any = false;
+        for (size_t size = 1000; size <= options().max_size; size *= 100)
+        {
+            any = any || latency_selected(size);
+        }
+        if (!any)
+        {
+            return;
+        }
+        uint64_t overhead = clock_overhead();
+        std::cout << "clock overhead: " << overhead << " ns" << std::endl;
+        for (size_t size = 1000; size <= options().max_size; size *= 100)
+        {
+            run_latency(size, overhead);
+        }
+    }
+}
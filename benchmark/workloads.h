@@ -0,0 +1,317 @@
+#pragma once
+#include "../dvector/dvector.h"
+#include "benchmark.h"
+#include <cstdint>
+#include <deque>
+#include <random>
+#include <string>
+#include <type_traits>
+#include <vector>
+#if defined(__GLIBCXX__) && __has_include(<ext/rope>)
+#include <ext/rope>
+#define BM_HAS_ROPE 1
+#endif
+
+namespace bm
+{
+    /*
+        Workload matrix: every workload below, for int, a 64 byte POD and
+        std::string elements, on dv::dvector, std::vector, std::deque and, with
+        libstdc++, __gnu_cxx::rope. Sizes go from 1000 up to Options::max_size by
+        factors of 100. Tasks are named matrix/<workload>/<type>/<container>/<size>,
+        so --filter picks slices of the matrix and --json reports all of it.
+
+            append            push_back `size` elements into an empty container
+            queue             push_back and pop_front pairs
+            zipf_edits        insert and erase at positions drawn from 1024 hot
+                              spots with Zipf(1) popularity
+            clustered_edits   an editor: inserts and erases around a cursor that
+                              moves a few places, and jumps anywhere 2% of the time
+            read_heavy        95% random reads, 5% random inserts and erases
+            scan              read every element in order
+
+        Except for append, the container is built once per task and kept across
+        runs at about its size, so it ages as a long lived one would. vector and
+        deque skip the edit workloads above 1000000 elements, where one run would
+        take minutes, and vector skips queue there too. rope holds only trivially
+        copyable elements.
+     */
+    struct pod64
+    {
+        int64_t key;
+        char payload[56];
+    };
+
+    template<class T>
+    T make_element(const size_t i)
+    {
+        if constexpr (std::is_same_v<T, int>)
+        {
+            return static_cast<int>(i);
+        }
+        else if constexpr (std::is_same_v<T, pod64>)
+        {
+            return pod64{ static_cast<int64_t>(i), {} };
+        }
+        else
+        {
+            // Past the small string buffer, like a line of text
+            std::string s = "line " + std::to_string(i);
+            s.resize(24, ' ');
+            return s;
+        }
+    }
+
+    inline size_t element_key(const int e) { return static_cast<size_t>(e); }
+    inline size_t element_key(const pod64 & e) { return static_cast<size_t>(e.key); }
+    inline size_t element_key(const std::string & e) { return e.size(); }
+
+    // The same operations over each container, by index, with any allocator
+
+    template<class T, class A, class P> void insert_at(dv::dvector<T, A, P> & c, const size_t i, const T & v) { c.insert(i, v); }
+    template<class T, class A> void insert_at(std::vector<T, A> & c, const size_t i, const T & v) { c.insert(c.begin() + i, v); }
+    template<class T, class A> void insert_at(std::deque<T, A> & c, const size_t i, const T & v) { c.insert(c.begin() + i, v); }
+
+    template<class T, class A, class P> void erase_at(dv::dvector<T, A, P> & c, const size_t i) { c.erase(i); }
+    template<class T, class A> void erase_at(std::vector<T, A> & c, const size_t i) { c.erase(c.begin() + i); }
+    template<class T, class A> void erase_at(std::deque<T, A> & c, const size_t i) { c.erase(c.begin() + i); }
+
+    template<class T, class A, class P> void pop_front(dv::dvector<T, A, P> & c) { c.pop_front(); }
+    template<class T, class A> void pop_front(std::vector<T, A> & c) { c.erase(c.begin()); }
+    template<class T, class A> void pop_front(std::deque<T, A> & c) { c.pop_front(); }
+
+    template<class C> struct is_dvector : std::false_type {};
+    template<class T, class A, class P> struct is_dvector<dv::dvector<T, A, P>> : std::true_type {};
+    template<class C> struct is_std_vector : std::false_type {};
+    template<class T, class A> struct is_std_vector<std::vector<T, A>> : std::true_type {};
+
+    template<class C>
+    size_t scan(C & c)
+    {
+        size_t sum = 0;
+        for (auto it = c.begin(); it != c.end(); ++it)
+        {
+            sum += element_key(*it);
+        }
+        return sum;
+    }
+
+#if BM_HAS_ROPE
+    template<class T> void insert_at(__gnu_cxx::rope<T> & c, const size_t i, const T & v) { c.insert(i, v); }
+    template<class T> void erase_at(__gnu_cxx::rope<T> & c, const size_t i) { c.erase(i, 1); }
+    template<class T> void pop_front(__gnu_cxx::rope<T> & c) { c.pop_front(); }
+
+    template<class T>
+    size_t scan(__gnu_cxx::rope<T> & c)
+    {
+        // The mutable iterators of a rope make a proxy per element
+        size_t sum = 0;
+        for (auto it = c.const_begin(); it != c.const_end(); ++it)
+        {
+            sum += element_key(*it);
+        }
+        return sum;
+    }
+#endif
+
+    class zipf_positions
+    {
+        // Positions in [0, size) near 1024 fixed spots, spot k drawn with weight 1 / (k + 1)
+        std::vector<double> cdf;
+        std::vector<double> spots;
+        std::uniform_real_distribution<double> uniform{ 0.0, 1.0 };
+    public:
+        explicit zipf_positions(std::mt19937_64 & e, const size_t count = 1024)
+        {
+            double total = 0;
+            for (size_t k = 0; k < count; k++)
+            {
+                total += 1.0 / (k + 1);
+                cdf.push_back(total);
+                spots.push_back(uniform(e));
+            }
+            for (auto & c : cdf)
+            {
+                c /= total;
+            }
+        }
+
+        size_t operator () (std::mt19937_64 & e, const size_t size)
+        {
+            auto k = std::lower_bound(cdf.begin(), cdf.end(), uniform(e)) - cdf.begin();
+            auto spot = spots[std::min(static_cast<size_t>(k), spots.size() - 1)];
+            return std::min(size - 1, static_cast<size_t>(spot * size));
+        }
+    };
+
+    enum class workload { append, queue, zipf_edits, clustered_edits, read_heavy, scan };
+
+    inline const char * workload_name(const workload w)
+    {
+        const char * names[] = { "append", "queue", "zipf_edits", "clustered_edits", "read_heavy", "scan" };
+        return names[static_cast<int>(w)];
+    }
+
+    template<class C, class T>
+    bool workload_skipped(const workload w, const size_t size)
+    {
+        constexpr bool linear_edits = !is_dvector<C>::value
+#if BM_HAS_ROPE
+            && !std::is_same_v<C, __gnu_cxx::rope<T>>
+#endif
+            ;
+        bool edits = w == workload::zipf_edits || w == workload::clustered_edits || w == workload::read_heavy;
+        return size > 1000000 && ((linear_edits && edits) || (is_std_vector<C>::value && w == workload::queue));
+    }
+
+    template<class C, class T>
+    struct workload_run
+    {
+        // A container built for workload `w` and the task that runs it, `items` operations per run
+        C c;
+        std::mt19937_64 e{ 0 };
+        zipf_positions zipf{ e };
+        size_t cursor;
+        size_t next; // Keys of the elements inserted by the task
+        size_t items = 10000;
+        std::function<void()> task;
+
+        workload_run(const workload w, const size_t size)
+            : cursor(size / 2), next(size)
+        {
+            if (w != workload::append)
+            {
+                for (size_t i = 0; i < size; i++)
+                {
+                    c.push_back(make_element<T>(i));
+                }
+            }
+            switch (w)
+            {
+            case workload::append:
+                items = size;
+                task = [size]() {
+                    C fresh;
+                    for (size_t i = 0; i < size; i++)
+                    {
+                        fresh.push_back(make_element<T>(i));
+                    }
+                    do_not_optimize(fresh);
+                };
+                break;
+            case workload::queue:
+                task = [this]() {
+                    for (size_t i = 0; i < items; i++)
+                    {
+                        c.push_back(make_element<T>(next++));
+                        pop_front(c);
+                    }
+                };
+                break;
+            case workload::zipf_edits:
+                task = [this]() {
+                    for (size_t i = 0; i < items; i++)
+                    {
+                        insert_at(c, zipf(e, c.size() + 1), make_element<T>(next++));
+                        erase_at(c, zipf(e, c.size()));
+                    }
+                };
+                break;
+            case workload::clustered_edits:
+                task = [this, size]() {
+                    for (size_t i = 0; i < items; i++)
+                    {
+                        if (e() % 50 == 0)
+                        {
+                            cursor = e() % c.size();
+                        }
+                        else
+                        {
+                            cursor = (cursor + c.size() + e() % 17 - 8) % c.size();
+                        }
+                        // Typing outweighs deleting, within 1000 elements of the initial size
+                        bool typing = e() % 10 < 6;
+                        if (c.size() <= size || (typing && c.size() < size + 1000))
+                        {
+                            insert_at(c, cursor, make_element<T>(next++));
+                        }
+                        else
+                        {
+                            erase_at(c, cursor);
+                        }
+                    }
+                };
+                break;
+            case workload::read_heavy:
+                items = 100000;
+                task = [this]() {
+                    bool insert = true;
+                    size_t sum = 0;
+                    for (size_t i = 0; i < items; i++)
+                    {
+                        if (e() % 100 < 5)
+                        {
+                            if (insert) insert_at(c, e() % (c.size() + 1), make_element<T>(next++));
+                            else erase_at(c, e() % c.size());
+                            insert = !insert;
+                        }
+                        else
+                        {
+                            sum += element_key(c[e() % c.size()]);
+                        }
+                    }
+                    do_not_optimize(sum);
+                };
+                break;
+            case workload::scan:
+                items = size;
+                task = [this]() {
+                    do_not_optimize(scan(c));
+                };
+                break;
+            }
+        }
+
+        workload_run(const workload_run &) = delete; // The task points to this
+    };
+
+    template<class C, class T>
+    void run_workload(const std::string & container, const std::string & type, const workload w, const size_t size)
+    {
+        std::string name = std::string("matrix/") + workload_name(w) + "/" + type + "/" + container + "/" + std::to_string(size);
+        if (workload_skipped<C, T>(w, size) || !selected({ name }))
+        {
+            return;
+        }
+        workload_run<C, T> run(w, size);
+        std::cout << Benchmark({ name }, { run.task }).per_run({ run.items }).get();
+    }
+
+    template<class T>
+    void run_workload_matrix(const std::string & type)
+    {
+        for (size_t size = 1000; size <= options().max_size; size *= 100)
+        {
+            for (auto w : { workload::append, workload::queue, workload::zipf_edits,
+                workload::clustered_edits, workload::read_heavy, workload::scan })
+            {
+                run_workload<dv::dvector<T>, T>("dvector", type, w, size);
+                run_workload<std::vector<T>, T>("vector", type, w, size);
+                run_workload<std::deque<T>, T>("deque", type, w, size);
+#if BM_HAS_ROPE
+                if constexpr (std::is_trivially_copyable_v<T>)
+                {
+                    run_workload<__gnu_cxx::rope<T>, T>("rope", type, w, size);
+                }
+#endif
+            }
+        }
+    }
+
+    inline void run_workload_matrix()
+    {
+        run_workload_matrix<int>("int");
+        run_workload_matrix<pod64>("pod64");
+        run_workload_matrix<std::string>("string");
+    }
+}
@@ -1,8 +1,10 @@
 #pragma once
 #include <memory>
+#include <utility>
 
 #include "dleaf.h"
 #include "dnode.h"
+#include "dstats.h"
 
 #include <iostream>
 #include <typeinfo>
@@ -13,34 +15,179 @@ namespace dv
         class _Value_type>
         using _Rebind_alloc_t = typename std::allocator_traits<_Alloc>::template rebind_alloc<_Value_type>;
 
-    template<class T, class Allocator>
-    struct dvector_alloc_base
+    /*
+        Whether memory may be freed through a copy of an Allocator on another
+        thread while the owner keeps allocating through its own, see clear_async().
+        Only known for std::allocator: specialize it for allocators that are.
+     */
+    template<class Allocator>
+    struct is_thread_safe_allocator : std::false_type
     {
-        using LeafType = dleaf<T, Allocator>;
+    };
+
+    template<class T>
+    struct is_thread_safe_allocator<std::allocator<T>> : std::true_type
+    {
+    };
+
+    template<class Allocator>
+    constexpr bool is_thread_safe_allocator_v = is_thread_safe_allocator<Allocator>::value;
+
+    struct dmemory_usage
+    {
+        /*
+            Heap memory held by a dvector, see memory_usage(). Elements held inline
+            are part of sizeof(dvector), and memory owned by the elements themselves
+            (e.g. the characters of a std::string) is not counted.
+         */
+        size_t node_bytes = 0; // Inner nodes
+        size_t leaf_bytes = 0; // Leaves: slice bounds, buffer reference, cached weight
+        size_t element_bytes = 0; // Elements in the tree, sizeof(T) each
+        size_t dead_bytes = 0; // Buffer capacity no element uses: spare room, erased and popped slots
+        size_t header_bytes = 0; // Buffer headers and their reference counts
+        size_t allocations = 0; // Heap blocks holding all of the above
+
+        size_t total() const noexcept
+        {
+            return node_bytes + leaf_bytes + element_bytes + dead_bytes + header_bytes;
+        }
+    };
+
+    template<bool enabled>
+    struct dcompact_state
+    {
+        // Automatic compaction off: no leaf count is kept
+        void _leaves_added(const std::ptrdiff_t) noexcept
+        {
+        }
+
+        void _swap_compact_state(dcompact_state &) noexcept
+        {
+        }
+
+        void _reset_compact_state() noexcept
+        {
+        }
+    };
+
+    template<>
+    struct dcompact_state<true>
+    {
+        static constexpr size_t idle = static_cast<size_t>(-1);
+
+        size_t leaves = 0; // Leaves allocated and not freed yet, i.e. those in the tree
+        size_t sweep = idle; // Where the running compaction sweep goes on
+
+        void _leaves_added(const std::ptrdiff_t n) noexcept
+        {
+            leaves = static_cast<size_t>(static_cast<std::ptrdiff_t>(leaves) + n);
+        }
+
+        void _swap_compact_state(dcompact_state & other) noexcept
+        {
+            std::swap(leaves, other.leaves);
+            std::swap(sweep, other.sweep);
+        }
+
+        void _reset_compact_state() noexcept
+        {
+            leaves = 0;
+            sweep = idle;
+        }
+    };
+
+    template<class T, class Allocator, class NodeType = dnode, class Ownership = shared_ownership, 
+        bool Stats = false, bool AutoCompact = false>
+    struct dvector_alloc_base : private Allocator, // An empty allocator takes no room
+        public dstats_state<Stats>, public dcompact_state<AutoCompact>
+    {
+        /*
+            Keeps the container's allocator. Nodes and leaves come from copies of it
+            rebound to their type, vectors are built with it and the buffers they
+            end up in are allocated from the vector's own, so a stateful allocator
+            (e.g. std::pmr::polymorphic_allocator) reaches every allocation.
+         */
+        using LeafType = dleaf<T, Allocator, typename NodeType::count_type, Ownership>;
         using LeafAlloc = _Rebind_alloc_t<Allocator, LeafType>;
-        using NodeAlloc = _Rebind_alloc_t<Allocator, dnode>;
-        using NodeBaseAlloc = _Rebind_alloc_t<Allocator, dnode_base>;
+        using NodeAlloc = _Rebind_alloc_t<Allocator, NodeType>;
+
+        dvector_alloc_base() = default;
+
+        explicit dvector_alloc_base(const Allocator & alloc)
+            : Allocator(alloc)
+        {
+        }
+
+        Allocator get_allocator() const noexcept
+        {
+            return static_cast<const Allocator &>(*this);
+        }
+
+        void _set_allocator(const Allocator & alloc) noexcept
+        {
+            static_cast<Allocator &>(*this) = alloc;
+        }
 
         template<typename... Args>
         LeafType * leaf_construct(Args&&... args)
         {
-            auto ptr = LeafAlloc().allocate(1);
-            ptr = new (ptr) LeafType(std::forward<Args>(args)...);
-            return ptr;
+            LeafAlloc alloc(get_allocator());
+            auto ptr = alloc.allocate(1);
+            this->_counted(&dcounters::leaf_allocations);
+            this->_leaves_added(1);
+            try
+            {
+                return new (ptr) LeafType(std::forward<Args>(args)...);
+            }
+            catch (...)
+            {
+                alloc.deallocate(ptr, 1);
+                this->_leaves_added(-1);
+                throw;
+            }
         }
 
         template<typename... Args>
-        dnode * node_construct(Args&&... args)
+        NodeType * node_construct(Args&&... args)
+        {
+            NodeAlloc alloc(get_allocator());
+            auto ptr = alloc.allocate(1);
+            this->_counted(&dcounters::node_allocations);
+            try
+            {
+                return new (ptr) NodeType(std::forward<Args>(args)...);
+            }
+            catch (...)
+            {
+                alloc.deallocate(ptr, 1);
+                throw;
+            }
+        }
+
+        void leaf_destroy(LeafType * leaf)
+        {
+            leaf->LeafType::~LeafType(); // Qualified: no virtual dispatch, the type is known
+            LeafAlloc(get_allocator()).deallocate(leaf, 1);
+            this->_leaves_added(-1);
+        }
+
+        void node_destroy(NodeType * node)
         {
-            auto ptr = NodeAlloc().allocate(1);
-            ptr = new (ptr) dnode(std::forward<Args>(args)...);
-            return ptr;
+            node->NodeType::~NodeType(); // Inlined away unless NodeType carries a payload
+            NodeAlloc(get_allocator()).deallocate(node, 1);
         }
 
-        void destroy(dnode_base * n)
+        void destroy(basic_dnode_base<typename NodeType::count_type> * n)
         {
-            n->~dnode_base();
-            NodeBaseAlloc().deallocate(n, 1);
+            // Deallocate through the allocator of the real type, so that the sizes match
+            if (n->type == 'l')
+            {
+                leaf_destroy(static_cast<LeafType*>(n));
+            }
+            else
+            {
+                node_destroy(static_cast<NodeType*>(n));
+            }
         }
     };
-}
\ No newline at end of file
+}
@@ -0,0 +1,207 @@
+#pragma once
+#include <vector>
+#include <memory>
+#include <new>
+#include <cstddef>
+
+namespace dv
+{
+    /*
+        Buffer ownership: how the slices of one vector count their references.
+
+        shared_ownership: std::shared_ptr, atomic reference counts next to the
+            vector, so the buffer is freed once whatever thread drops it last.
+            The count of viewed elements, `live`, is a plain one though: only
+            leaves split from one another share a buffer, they all belong to one
+            dvector (a copy gets buffers of its own), so only that dvector or
+            clear_async freeing its old tree ever changes it.
+        local_ownership: plain counts in the buffer header, no atomic operations.
+            For a dvector used by one thread at a time; handing it over by moving
+            it is fine, the leaves go along.
+        paged_ownership: counted like local_ownership, and the elements are paged
+            out to a file when not in use, see dpaged.h.
+
+        Besides operator->, a buffer pointer has read(), for accesses that do not
+        change the elements, and live() and capacity(), which reach the count of
+        viewed elements and the room of the buffer without needing the elements.
+     */
+    struct shared_ownership
+    {
+    };
+
+    struct local_ownership
+    {
+    };
+
+    struct paged_ownership
+    {
+    };
+
+    template<class T, class Allocator = std::allocator<T>>
+    struct dbuffer
+    {
+        // The vector slices point into, and how many of its elements they still view
+        std::vector<T, Allocator> elements;
+        size_t live = 0;
+
+        // Or memory adopted from outside: `elements` stays empty and never grows,
+        // the deleter of `adopted` gets the memory back with the buffer
+        std::shared_ptr<T> adopted;
+        size_t adopted_size = 0;
+
+        dbuffer(std::vector<T, Allocator> && _elements)
+            : elements(std::move(_elements))
+        {
+        }
+
+        dbuffer(const std::vector<T, Allocator> & _elements)
+            : elements(_elements, _elements.get_allocator()) // Stays with the same allocator
+        {
+        }
+
+        T * data() noexcept
+        {
+            return adopted != nullptr ? adopted.get() : elements.data();
+        }
+
+        const T * data() const noexcept
+        {
+            return adopted != nullptr ? adopted.get() : elements.data();
+        }
+
+        size_t size() const noexcept
+        {
+            return adopted != nullptr ? adopted_size : elements.size();
+        }
+
+        size_t capacity() const noexcept
+        {
+            return adopted != nullptr ? adopted_size : elements.capacity();
+        }
+    };
+
+    template<class T, class Allocator = std::allocator<T>, class Ownership = shared_ownership>
+    class dbuffer_ptr;
+
+    template<class T, class Allocator>
+    class dbuffer_ptr<T, Allocator, shared_ownership> : public std::shared_ptr<dbuffer<T, Allocator>>
+    {
+        using Base = std::shared_ptr<dbuffer<T, Allocator>>;
+    public:
+        // allocate_shared's block: the buffer behind a vtable pointer and two counts, an estimate
+        static constexpr size_t header_bytes = sizeof(dbuffer<T, Allocator>) + sizeof(void*) + 2 * sizeof(int);
+
+        // The control block comes from the allocator of the vector
+        explicit dbuffer_ptr(std::vector<T, Allocator> && elements)
+            : Base(std::allocate_shared<dbuffer<T, Allocator>>(elements.get_allocator(), std::move(elements)))
+        {
+        }
+
+        explicit dbuffer_ptr(const std::vector<T, Allocator> & elements)
+            : Base(std::allocate_shared<dbuffer<T, Allocator>>(elements.get_allocator(), elements))
+        {
+        }
+
+        const dbuffer<T, Allocator> * read() const noexcept
+        {
+            return this->get();
+        }
+
+        size_t & live() const noexcept
+        {
+            return this->get()->live;
+        }
+
+        size_t capacity() const noexcept
+        {
+            return this->get()->capacity();
+        }
+    };
+
+    template<class T, class Allocator>
+    class dbuffer_ptr<T, Allocator, local_ownership>
+    {
+        struct counted : public dbuffer<T, Allocator>
+        {
+            using dbuffer<T, Allocator>::dbuffer;
+            size_t refs = 1;
+        };
+        using CountedAlloc = typename std::allocator_traits<Allocator>::template rebind_alloc<counted>;
+
+        counted * buffer;
+    public:
+        static constexpr size_t header_bytes = sizeof(counted);
+    private:
+
+        template<class Elements>
+        static counted * _make(Elements && elements)
+        {
+            // Header and vector in one allocation from the vector's allocator, like allocate_shared
+            CountedAlloc alloc(elements.get_allocator());
+            auto ptr = alloc.allocate(1);
+            try
+            {
+                return new (ptr) counted(std::forward<Elements>(elements));
+            }
+            catch (...)
+            {
+                alloc.deallocate(ptr, 1);
+                throw;
+            }
+        }
+    public:
+        explicit dbuffer_ptr(std::vector<T, Allocator> && elements)
+            : buffer(_make(std::move(elements)))
+        {
+        }
+
+        explicit dbuffer_ptr(const std::vector<T, Allocator> & elements)
+            : buffer(_make(elements))
+        {
+        }
+
+        dbuffer_ptr(const dbuffer_ptr & other) noexcept
+            : buffer(other.buffer)
+        {
+            buffer->refs += 1;
+        }
+
+        dbuffer_ptr & operator = (const dbuffer_ptr & other) = delete;
+
+        ~dbuffer_ptr()
+        {
+            buffer->refs -= 1;
+            if (buffer->refs == 0)
+            {
+                CountedAlloc alloc(buffer->elements.get_allocator());
+                buffer->counted::~counted();
+                alloc.deallocate(buffer, 1);
+            }
+        }
+
+        dbuffer<T, Allocator> * operator -> () const noexcept
+        {
+            return buffer;
+        }
+
+        const dbuffer<T, Allocator> * read() const noexcept
+        {
+            return buffer;
+        }
+
+        size_t & live() const noexcept
+        {
+            return buffer->live;
+        }
+
+        size_t capacity() const noexcept
+        {
+            return buffer->capacity();
+        }
+
+        size_t use_count() const noexcept
+        {
+            return buffer->refs;
+        }
+    };
+}
@@ -5,13 +5,15 @@
 
 namespace dv
 {
-    template<class T, class Allocator = std::allocator<T>>
-    struct dleaf : public dnode_base
+    template<class T, class Allocator = std::allocator<T>, class Count = size_t, class Ownership = shared_ownership>
+    struct dleaf : public basic_dnode_base<Count>
     {
     public:
-        using ValueType = dslice<T, Allocator>;
-        using LeafType = dleaf<T, Allocator>;
+        using ValueType = dslice<T, Allocator, Ownership>;
+        using LeafType = dleaf<T, Allocator, Count, Ownership>;
+        using dnode_base = basic_dnode_base<Count>;
         ValueType value;
+        Count weight_sum = 0; // total weight of `value`, only maintained by weighted dvectors
 
         explicit dleaf(const ValueType & value)
             : value(value)
@@ -25,16 +27,21 @@ namespace dv
             dnode_base::type = 'l';
         }
 
-        virtual size_t count() const noexcept override
+        virtual Count count() const noexcept override
         {
-            return value.size();
+            return static_cast<Count>(value.size());
+        }
+
+        virtual Count weight() const noexcept override
+        {
+            return weight_sum;
         }
  
         dnode_base * get_brother()
         {
+            auto p = this->p;
             if (p != nullptr)
             {
-                auto ptr = static_cast<dnode*>(p);
                 if (p->is_left_child(this))
                 {
                     return p->right;
@@ -2,4 +2,12 @@
 
 #ifndef DV_PROTECTED
 #define DV_PROTECTED protected
+#endif
+
+#ifndef DV_INLINE_BYTES
+#define DV_INLINE_BYTES 32 // Bytes of elements a dvector keeps inline before building its tree
+#endif
+
+#ifndef DV_STATS
+#define DV_STATS 0 // 1 to keep rebalancing and allocation counters in every dvector, see dstats.h
 #endif
\ No newline at end of file
@@ -5,28 +5,38 @@
 
 namespace dv
 {
-    struct dnode : public dnode_base
+    template<class Count = size_t>
+    struct basic_dnode : public basic_dnode_base<Count>
     {
+        using dnode_base = basic_dnode_base<Count>;
+
         static inline char _id = 'a';
 
+        // Small fields first, so that they can share padding with `type`
         int8_t h = 0;
+        char id;
         dnode_base * left = nullptr;
         dnode_base * right = nullptr;
-        size_t elem_count = 0;
-        char id;
+        Count elem_count = 0;
+        Count elem_weight = 0; // cached weight(), only maintained by weighted dvectors
 
-        dnode()
+        basic_dnode()
         {
             id = _id;
             _id = (_id - 'a') % 26 + 1 + 'a';
             dnode_base::type = 'n';
         }
 
-        virtual size_t count() const noexcept override
+        virtual Count count() const noexcept override
         {
             return elem_count;
         }
 
+        virtual Count weight() const noexcept override
+        {
+            return elem_weight;
+        }
+
         bool is_left_child(dnode_base * n)
         {
             return this->left == n;
@@ -49,15 +59,6 @@ namespace dv
             n->p = this;
         }
 
-        void renew_count() noexcept
-        {
-            this->elem_count = this->left->count() + this->right->count();
-            if (this->p != nullptr)
-            {
-                this->p->renew_count();
-            }
-        }
-
         void renew_height(char source, int height_change) noexcept
         {
             if (source == 'l')
@@ -70,6 +71,8 @@ namespace dv
             }
         }
 
-        virtual ~dnode() { /*std::cout << "~dnode is called!!!";*/ }
+        virtual ~basic_dnode() { /*std::cout << "~dnode is called!!!";*/ }
     };
+
+    using dnode = basic_dnode<size_t>;
 }
\ No newline at end of file
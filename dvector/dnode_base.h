@@ -1,17 +1,26 @@
 #pragma once
 
+#include <cstddef>
+
 namespace dv
 {
-    struct dnode;
+    template<class Count>
+    struct basic_dnode;
 
-    struct dnode_base 
+    template<class Count = size_t>
+    struct basic_dnode_base 
     {
+        using count_type = Count;
+
+        basic_dnode<Count> * p = nullptr;
         char type; /*
                      'n' : indicates non-leaf node
                      'l' : indicates leaf node
                    */
-        dnode * p = nullptr;
-        virtual size_t count() const noexcept = 0;
-        virtual ~dnode_base() {}
+        virtual Count count() const noexcept = 0;
+        virtual Count weight() const noexcept = 0;
+        virtual ~basic_dnode_base() {}
     };
-}
\ No newline at end of file
+
+    using dnode_base = basic_dnode_base<size_t>;
+}
@@ -0,0 +1,417 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <exception>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <vector>
+#include "dbuffer.h"
+#include "dpolicy.h"
+
+namespace dv
+{
+    /*
+        Out-of-core storage. With paged_ownership the vectors leaves view are
+        pages: a dpage_cache keeps the most recently used ones in memory, up to
+        a byte budget, and writes the others to a scratch file, reading them back
+        when a slice next needs its elements. Nodes, leaves and buffer headers stay
+        in memory, so indexing, insertion and erasure keep their O(log N) shape and
+        only touch the pages of the leaves they reach.
+
+        The cache is reached through the allocator, dpaged_allocator, which all
+        vectors of the dvector are built with:
+
+            dv::dpage_cache cache("sequence.pages", 64 << 20);
+            dv::paged::dvector<int> d(&cache);
+
+        Elements must be trivially copyable, they are written as bytes. A reference
+        to an element is only valid until the dvector is next used, its page may
+        then be written out. Neither the cache nor its dvectors are thread-safe.
+     */
+    struct dpage
+    {
+        // What the cache knows of a page: its place in the LRU list and in the file
+        dpage * newer = nullptr;
+        dpage * older = nullptr;
+        uint64_t offset = 0;
+        uint64_t extent = 0; // Bytes reserved in the file, 0 for none yet
+        size_t resident_bytes = 0;
+        bool resident = true;
+        bool dirty = true; // Changed since it was last written
+
+        virtual size_t _bytes() const noexcept = 0;
+        virtual void _write(std::fstream & file) = 0;
+        virtual void _read(std::fstream & file) = 0;
+        virtual void _drop() noexcept = 0;
+        virtual ~dpage() = default;
+    };
+
+    class dpage_cache
+    {
+    private:
+        // Pages stay in memory while they are among the most recently used ones, so
+        // that the few a single operation works on at once are never written out
+        static constexpr size_t min_resident = 8;
+
+        std::string path;
+        std::fstream file;
+        uint64_t file_end = 0;
+        std::multimap<uint64_t, uint64_t> free_extents; // Bytes -> offset
+
+        size_t budget;
+        size_t resident_bytes = 0;
+        size_t resident_pages = 0;
+        dpage * newest = nullptr;
+        dpage * oldest = nullptr;
+
+        void _unlink(dpage * page) noexcept
+        {
+            (page->newer != nullptr ? page->newer->older : newest) = page->older;
+            (page->older != nullptr ? page->older->newer : oldest) = page->newer;
+            page->newer = nullptr;
+            page->older = nullptr;
+        }
+
+        void _link_newest(dpage * page) noexcept
+        {
+            page->older = newest;
+            (newest != nullptr ? newest->newer : oldest) = page;
+            newest = page;
+        }
+
+        void _release_extent(dpage * page)
+        {
+            if (page->extent != 0)
+            {
+                free_extents.emplace(page->extent, page->offset);
+                page->extent = 0;
+            }
+        }
+
+        void _reserve_extent(dpage * page, const uint64_t bytes)
+        {
+            // Best fit among the freed extents, or the end of the file
+            if (page->extent >= bytes)
+            {
+                return;
+            }
+            _release_extent(page);
+            auto fit = free_extents.lower_bound(bytes);
+            if (fit != free_extents.end())
+            {
+                page->extent = fit->first;
+                page->offset = fit->second;
+                free_extents.erase(fit);
+            }
+            else
+            {
+                page->extent = bytes;
+                page->offset = file_end;
+                file_end += bytes;
+            }
+        }
+
+        void _page_out(dpage * page)
+        {
+            if (page->dirty)
+            {
+                size_t bytes = page->_bytes();
+                _reserve_extent(page, bytes > 0 ? bytes : 1);
+                file.seekp(static_cast<std::streamoff>(page->offset));
+                page->_write(file);
+                if (!file)
+                {
+                    throw std::exception();
+                }
+                page->dirty = false;
+                writes += 1;
+            }
+            page->_drop();
+            page->resident = false;
+            _unlink(page);
+            resident_bytes -= page->resident_bytes;
+            resident_pages -= 1;
+            page->resident_bytes = 0;
+        }
+
+        void _used(dpage * page)
+        {
+            // `page` is in memory and linked: it becomes the newest, older ones go over budget
+            _link_newest(page);
+            size_t bytes = page->_bytes();
+            resident_bytes = resident_bytes + bytes - page->resident_bytes;
+            page->resident_bytes = bytes;
+            while (resident_bytes > budget && resident_pages > min_resident)
+            {
+                _page_out(oldest);
+            }
+        }
+    public:
+        size_t reads = 0; // Pages read back from the file
+        size_t writes = 0; // Pages written to it
+
+        dpage_cache(const std::string & path, const size_t budget_bytes)
+            : path(path),
+            file(path, std::ios::in | std::ios::out | std::ios::trunc | std::ios::binary),
+            budget(budget_bytes)
+        {
+            if (!file)
+            {
+                throw std::exception();
+            }
+        }
+
+        dpage_cache(const dpage_cache &) = delete;
+        dpage_cache & operator = (const dpage_cache &) = delete;
+
+        ~dpage_cache()
+        {
+            // Every dvector using the cache must be gone by now
+            file.close();
+            std::remove(path.c_str());
+        }
+
+        size_t resident() const noexcept
+        {
+            // Bytes of the pages in memory, as of their last use
+            return resident_bytes;
+        }
+
+        void make_room(const size_t bytes)
+        {
+            // Before a new page of `bytes` is made: the oldest pages go while it would not fit the budget
+            while (resident_bytes + bytes > budget && resident_pages + 1 > min_resident)
+            {
+                _page_out(oldest);
+            }
+        }
+
+        void admit(dpage * page) noexcept
+        {
+            // A new page, in memory and not written yet, after make_room: writes nothing, so cannot fail
+            resident_pages += 1;
+            _link_newest(page);
+            page->resident_bytes = page->_bytes();
+            resident_bytes += page->resident_bytes;
+        }
+
+        void touch(dpage * page)
+        {
+            // `page` is about to be used
+            if (page->resident)
+            {
+                _unlink(page);
+            }
+            else
+            {
+                file.seekg(static_cast<std::streamoff>(page->offset));
+                page->_read(file);
+                if (!file)
+                {
+                    throw std::exception();
+                }
+                page->resident = true;
+                resident_pages += 1;
+                reads += 1;
+            }
+            _used(page);
+        }
+
+        void forget(dpage * page) noexcept
+        {
+            // `page` is being freed
+            if (page->resident)
+            {
+                _unlink(page);
+                resident_bytes -= page->resident_bytes;
+                resident_pages -= 1;
+            }
+            if (page->extent != 0)
+            {
+                free_extents.emplace(page->extent, page->offset);
+            }
+        }
+    };
+
+    template<class T>
+    class dpaged_allocator : public std::allocator<T>
+    {
+        // std::allocator that also carries the cache the pages of a dvector go to
+        dpage_cache * page_cache;
+    public:
+        template<class U> struct rebind { using other = dpaged_allocator<U>; };
+        using is_always_equal = std::false_type;
+
+        dpaged_allocator(dpage_cache * cache) noexcept
+            : page_cache(cache)
+        {
+        }
+
+        template<class U>
+        dpaged_allocator(const dpaged_allocator<U> & other) noexcept
+            : page_cache(other.cache())
+        {
+        }
+
+        dpage_cache * cache() const noexcept
+        {
+            return page_cache;
+        }
+    };
+
+    template<class T, class U>
+    bool operator == (const dpaged_allocator<T> & a, const dpaged_allocator<U> & b) noexcept
+    {
+        return a.cache() == b.cache();
+    }
+
+    template<class T, class U>
+    bool operator != (const dpaged_allocator<T> & a, const dpaged_allocator<U> & b) noexcept
+    {
+        return !(a == b);
+    }
+
+    template<class T, class Allocator>
+    class dbuffer_ptr<T, Allocator, paged_ownership>
+    {
+        static_assert(std::is_trivially_copyable_v<T> && std::is_default_constructible_v<T>,
+            "paged elements are written and read back as bytes");
+
+        struct counted : public dbuffer<T, Allocator>, public dpage
+        {
+            using dbuffer<T, Allocator>::dbuffer;
+            size_t refs = 1;
+            size_t count = 0; // Elements while paged out
+
+            size_t _bytes() const noexcept override
+            {
+                return this->elements.capacity() * sizeof(T);
+            }
+
+            void _write(std::fstream & file) override
+            {
+                file.write(reinterpret_cast<const char*>(this->elements.data()),
+                    static_cast<std::streamsize>(this->elements.size() * sizeof(T)));
+            }
+
+            void _read(std::fstream & file) override
+            {
+                this->elements.resize(count);
+                file.read(reinterpret_cast<char*>(this->elements.data()),
+                    static_cast<std::streamsize>(count * sizeof(T)));
+            }
+
+            void _drop() noexcept override
+            {
+                count = this->elements.size();
+                std::vector<T, Allocator>(this->elements.get_allocator()).swap(this->elements);
+            }
+        };
+        using CountedAlloc = typename std::allocator_traits<Allocator>::template rebind_alloc<counted>;
+
+        counted * buffer;
+
+        template<class Elements>
+        static counted * _make(Elements && elements)
+        {
+            /*
+                Older pages are written out first: if that fails, `elements` are
+                still untouched and no page of them was linked into the cache.
+             */
+            CountedAlloc alloc(elements.get_allocator());
+            auto cache = elements.get_allocator().cache();
+            cache->make_room(elements.capacity() * sizeof(T));
+            auto ptr = alloc.allocate(1);
+            counted * made;
+            try
+            {
+                made = new (ptr) counted(std::forward<Elements>(elements));
+            }
+            catch (...)
+            {
+                alloc.deallocate(ptr, 1);
+                throw;
+            }
+            cache->admit(made);
+            return made;
+        }
+
+        dpage_cache * _cache() const noexcept
+        {
+            return buffer->elements.get_allocator().cache();
+        }
+    public:
+        static constexpr size_t header_bytes = sizeof(counted);
+
+        explicit dbuffer_ptr(std::vector<T, Allocator> && elements)
+            : buffer(_make(std::move(elements)))
+        {
+        }
+
+        explicit dbuffer_ptr(const std::vector<T, Allocator> & elements)
+            : buffer(_make(elements))
+        {
+        }
+
+        dbuffer_ptr(const dbuffer_ptr & other) noexcept
+            : buffer(other.buffer)
+        {
+            buffer->refs += 1;
+        }
+
+        dbuffer_ptr & operator = (const dbuffer_ptr & other) = delete;
+
+        ~dbuffer_ptr()
+        {
+            buffer->refs -= 1;
+            if (buffer->refs == 0)
+            {
+                _cache()->forget(buffer);
+                CountedAlloc alloc(buffer->elements.get_allocator());
+                buffer->counted::~counted();
+                alloc.deallocate(buffer, 1);
+            }
+        }
+
+        dbuffer<T, Allocator> * operator -> () const
+        {
+            _cache()->touch(buffer);
+            buffer->dirty = true;
+            return buffer;
+        }
+
+        const dbuffer<T, Allocator> * read() const
+        {
+            _cache()->touch(buffer);
+            return buffer;
+        }
+
+        size_t & live() const noexcept
+        {
+            return buffer->live;
+        }
+
+        size_t capacity() const noexcept
+        {
+            // Of the page in memory, or of what was written out, without reading it back
+            return buffer->resident ? buffer->capacity() : buffer->count;
+        }
+
+        size_t use_count() const noexcept
+        {
+            return buffer->refs;
+        }
+    };
+
+    struct paged_policy : default_policy
+    {
+        // Leaves, and so the pages new elements go to, hold at most 1024 elements
+        static constexpr size_t leaf_capacity = 1024;
+        using buffer_ownership = paged_ownership;
+    };
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <cstddef>
+#include "dweight.h"
+#include "dbuffer.h"
+#include "dmarcos.h"
+
+namespace dv
+{
+    /*
+        Policies tune a dvector at compile time. Every member is read through
+        `if constexpr` or as a type, so a policy costs no runtime branching.
+
+        Derive from default_policy and override what you need:
+
+            struct my_policy : dv::default_policy
+            {
+                static constexpr size_t leaf_capacity = 256;
+                using count_type = uint32_t;
+            };
+
+            dv::dvector<int, std::allocator<int>, my_policy> d;
+     */
+
+    struct avl_balance
+    {
+        // Height-balanced, rebalanced by rotations (dvector_base::_rebalance_step)
+    };
+
+    struct weight_balance
+    {
+        /*
+            Leaf-count balanced (scapegoat tree): no balance factor is kept,
+            a subtree whose child holds more than alpha of its leaves is
+            rebuilt perfectly balanced when an insertion gets too deep.
+         */
+        static constexpr double alpha = 0.7;
+    };
+
+    struct default_policy
+    {
+        // Most elements an append may put into one leaf, 0 for unbounded.
+        // Bulk construction and bulk insertion are also cut into leaves of this size.
+        static constexpr size_t leaf_capacity = 0;
+
+        // Type of the per-node element counts and cached weights
+        using count_type = size_t;
+
+        // avl_balance or weight_balance
+        using balance = avl_balance;
+
+        // Aggregate hook: weight of each element, cached per subtree. See dweight.h
+        using weigher = no_weight;
+
+        // Bytes of elements kept inside the dvector before the tree is built
+        static constexpr size_t inline_bytes = DV_INLINE_BYTES;
+
+        // How leaves count references to the vectors they share, see dbuffer.h
+        using buffer_ownership = shared_ownership;
+
+        // A leaf whose shared vector has fewer than 1 / repack_ratio of its elements
+        // still in use is copied into a vector of its own by erase, 0 never repacks
+        static constexpr size_t repack_ratio = 4;
+
+        // Keep the counters of dstats.h (rotations, splits, allocations...), costs nothing when off
+        static constexpr bool stats = DV_STATS;
+
+        // Automatic compaction: once leaves average under a quarter of compact size, every
+        // insert and erase packs about this many more elements until a sweep is done, 0 off
+        static constexpr size_t auto_compact = 0;
+    };
+
+    template<class Weigher, class Policy = default_policy>
+    struct weighted_policy : public Policy
+    {
+        using weigher = Weigher;
+    };
+}
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <cstddef>
+#include <deque>
+#include <future>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+
+namespace dv
+{
+    class dreclaimer
+    {
+        /*
+            The one thread that frees the trees handed over by clear_async(). Trees
+            are freed in the order they were posted. At most `max_pending` wait at
+            a time: past that, post() refuses and the caller frees the tree itself,
+            so a burst of clears cannot hold an unbounded amount of memory.
+            The thread is started on first use and joined at exit, once every tree
+            posted before then is freed.
+         */
+    public:
+        static constexpr size_t max_pending = 64;
+
+        static dreclaimer & instance()
+        {
+            static dreclaimer reclaimer;
+            return reclaimer;
+        }
+
+        bool post(std::packaged_task<void()> & job) noexcept
+        {
+            // False if `job` was not taken: the queue is full, or no memory to queue it
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (stopping || jobs.size() >= max_pending)
+                {
+                    return false;
+                }
+                try
+                {
+                    jobs.push_back(std::move(job));
+                }
+                catch (...)
+                {
+                    return false;
+                }
+            }
+            wake.notify_one();
+            return true;
+        }
+
+        dreclaimer(const dreclaimer &) = delete;
+        dreclaimer & operator=(const dreclaimer &) = delete;
+
+        ~dreclaimer()
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                stopping = true;
+            }
+            wake.notify_one();
+            worker.join();
+        }
+
+    private:
+        dreclaimer() : worker([this] { _run(); })
+        {
+        }
+
+        void _run()
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            while (true)
+            {
+                wake.wait(lock, [this] { return stopping || !jobs.empty(); });
+                if (jobs.empty())
+                {
+                    return;
+                }
+                auto job = std::move(jobs.front());
+                jobs.pop_front();
+                lock.unlock();
+                job(); // Whatever it throws is kept in its future
+                lock.lock();
+            }
+        }
+
+        std::mutex mutex;
+        std::condition_variable wake;
+        std::deque<std::packaged_task<void()>> jobs;
+        bool stopping = false;
+        std::thread worker; // Last, started once the rest is ready
+    };
+}
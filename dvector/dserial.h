@@ -0,0 +1,113 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <istream>
+#include <ostream>
+
+namespace dv
+{
+    /*
+        Binary format of dvector::save and dvector::load, for trivially copyable T:
+
+            dfile_header
+            uint64_t leaf_sizes[leaves]     the tree, as the sizes of its leaves in order
+            T elements[elements]            the leaves one after another, as they are in memory
+
+        Native byte order and layout; `byte_order` and `element_size` reject
+        files written by a machine or a T that do not match.
+     */
+    struct dfile_header
+    {
+        static constexpr uint32_t current_version = 1;
+
+        char magic[4] = { 'd', 'v', 'e', 'c' };
+        uint32_t version = current_version;
+        uint32_t byte_order = 0x01020304;
+        uint32_t element_size = 0;
+        uint64_t elements = 0;
+        uint64_t leaves = 0;
+
+        bool valid(const size_t expected_element_size) const noexcept
+        {
+            dfile_header reference;
+            return std::memcmp(magic, reference.magic, sizeof(magic)) == 0 &&
+                version == current_version && byte_order == reference.byte_order &&
+                element_size == expected_element_size &&
+                (elements == 0 || leaves > 0) && leaves <= elements;
+        }
+    };
+
+    template<class T>
+    void _write_raw(std::ostream & out, const T * data, const size_t count)
+    {
+        out.write(reinterpret_cast<const char*>(data), static_cast<std::streamsize>(count * sizeof(T)));
+        if (!out)
+        {
+            throw std::exception();
+        }
+    }
+
+    inline uint64_t _remaining_bytes(std::istream & in)
+    {
+        // Bytes left in `in`, UINT64_MAX when it cannot seek
+        auto here = in.tellg();
+        if (here == std::istream::pos_type(-1) || !in.seekg(0, std::ios::end))
+        {
+            in.clear();
+            return UINT64_MAX;
+        }
+        auto end = in.tellg();
+        in.seekg(here);
+        if (end == std::istream::pos_type(-1) || !in)
+        {
+            in.clear();
+            in.seekg(here);
+            return UINT64_MAX;
+        }
+        return static_cast<uint64_t>(end - here);
+    }
+
+    template<class T>
+    void _read_raw(std::istream & in, T * data, const size_t count)
+    {
+        in.read(reinterpret_cast<char*>(data), static_cast<std::streamsize>(count * sizeof(T)));
+        if (!in)
+        {
+            throw std::exception();
+        }
+    }
+
+    // Bytes a vector grows by at least per read when the length of the stream is unknown
+    constexpr size_t _read_chunk_bytes = size_t(1) << 20;
+
+    template<class Vector>
+    void _read_vector(std::istream & in, Vector & into, const uint64_t count, const bool known_length)
+    {
+        /*
+            Reads `count` elements into `into`, which is empty. When the length of
+            the stream is unknown, `count` is only what the header claims: `into`
+            then grows as the data arrives, doubling from _read_chunk_bytes, so a
+            stream that ends early fails having allocated a small multiple of its
+            length at most.
+         */
+        using T = typename Vector::value_type;
+        if (known_length)
+        {
+            into.resize(static_cast<size_t>(count));
+            _read_raw(in, into.data(), into.size());
+            return;
+        }
+        size_t done = 0;
+        while (done < count)
+        {
+            size_t step = static_cast<size_t>(std::min<uint64_t>(count - done, 
+                std::max({ done, _read_chunk_bytes / sizeof(T), size_t(1) })));
+            into.resize(done + step);
+            _read_raw(in, into.data() + done, step);
+            done += step;
+        }
+    }
+}
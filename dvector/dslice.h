@@ -2,37 +2,41 @@
 #include <vector>
 #include <memory>
 #include <cassert>
+#include <type_traits>
+#include "dbuffer.h"
 
 namespace dv
 {
-    template<class T, class Allocator = std::allocator<T>>
+    template<class T, class Allocator = std::allocator<T>, class Ownership = shared_ownership>
     class _dslice_base
     {
-    protected:
+    public:
         using Vector = std::vector<T, Allocator>;
-        using Self = _dslice_base<T, Allocator>;
-        const std::shared_ptr<Vector> base_vector;
+        using BufferPtr = dbuffer_ptr<T, Allocator, Ownership>;
+    protected:
+        using Self = _dslice_base<T, Allocator, Ownership>;
+        const BufferPtr base_vector;
     public:
         _dslice_base(Vector && _base_vector)
-            : base_vector(std::allocate_shared<Vector>(Allocator(), std::move(_base_vector)))
+            : base_vector(std::move(_base_vector))
         {
             //std::cout << "_dslice_base called on move" << std::endl;
             //std::cout << "_dslice_base(): use_count == " << base_vector.use_count() << std::endl;
         }
 
         _dslice_base(const Vector & _base_vector)
-            : base_vector(std::allocate_shared<Vector>(Allocator(), _base_vector))
+            : base_vector(_base_vector)
         {
             //std::cout << "_dslice_base called on copy" << std::endl;
         }
 
-        _dslice_base(const std::shared_ptr<Vector> & _base_vector)
+        _dslice_base(const BufferPtr & _base_vector)
             : base_vector(_base_vector)
         {
             //std::cout << "_dslice_base called on copy shared_ptr" << std::endl;
         }
 
-        _dslice_base(std::shared_ptr<Vector> && _base_vector)
+        _dslice_base(BufferPtr && _base_vector)
             : base_vector(std::move(_base_vector))
         {
             //std::cout << "_dslice_base called on move shared_ptr" << std::endl;
@@ -45,7 +49,25 @@ namespace dv
 
         const Vector & get_base_vector() const
         {
-            return *base_vector;
+            return base_vector.read()->elements;
+        }
+
+        const void * get_buffer_id() const noexcept
+        {
+            // The same for slices of the same buffer, found without reaching the elements
+            return &base_vector.live();
+        }
+
+        size_t get_live() const noexcept
+        {
+            // Elements of the vector viewed by any slice
+            return base_vector.live();
+        }
+
+        size_t get_capacity() const noexcept
+        {
+            // Elements the buffer has room for, paged out or not
+            return base_vector.capacity();
         }
 
         ~_dslice_base()
@@ -54,36 +76,82 @@ namespace dv
         }
     };
 
-    template<class T, class Allocator = std::allocator<T>>
-    class dslice : public _dslice_base<T, Allocator>
+    template<class T, class Allocator = std::allocator<T>, class Ownership = shared_ownership>
+    class dslice : public _dslice_base<T, Allocator, Ownership>
     {
     private:
-        using Self = dslice<T, Allocator>;
-        using Base = _dslice_base<T, Allocator>;
-        using iterator = typename Base::Vector::iterator;
-        using const_iterator = typename Base::Vector::const_iterator;
+        using Self = dslice<T, Allocator, Ownership>;
+        using Base = _dslice_base<T, Allocator, Ownership>;
+        using iterator = T *;
+        using const_iterator = const T *;
 
         size_t _start;
         size_t _end;
+
+        typename Base::Vector & _elements() const noexcept
+        {
+            // For changes to the vector, never an adopted buffer's
+            return Base::base_vector->elements;
+        }
+
+        T * _data() const noexcept
+        {
+            // For changes to the elements
+            return Base::base_vector->data();
+        }
+
+        const dbuffer<T, Allocator> & _view() const noexcept
+        {
+            return *Base::base_vector.read();
+        }
+
+        bool _growable() const noexcept
+        {
+            // The vector is the one viewed, and can grow
+            return _view().adopted == nullptr;
+        }
+
+        void _discard(const size_t position)
+        {
+            // Frees what an element no longer viewed holds, its slot stays until the buffer goes
+            T discarded(std::move(_data()[position]));
+            (void)discarded;
+        }
     public:
         template<class... InitArgs>
         dslice(const size_t start, const size_t end, InitArgs&&... args) : 
             Base(std::forward<InitArgs>(args)...),
             _start(start), _end(end)
         {
+            Base::base_vector.live() += size();
         }
 
         dslice(const dslice & other) :
-            Base(*(other.base_vector)),
-            _start(other._start), _end(other._end)
+            Base(typename Base::Vector(other.begin(), other.end(), other.get_base_vector().get_allocator())),
+            _start(0), _end(other.size())
         {
+            // A copy owns only the viewed range
             //std::cout << "dslice copy is called" << std::endl;
+            Base::base_vector.live() += size();
+        }
+
+        dslice(dslice && other) noexcept :
+            Base(static_cast<const Base &>(other)),
+            _start(other._start), _end(other._end)
+        {
+            // A move keeps sharing the underlying vector
+            Base::base_vector.live() += size();
+        }
+
+        ~dslice()
+        {
+            Base::base_vector.live() -= size();
         }
 
         const T & operator[] (const size_t index) const
         {
-            assert(_start + index < end);
-            return (*Base::base_vector)[_start + index];
+            assert(_start + index < _end);
+            return _view().data()[_start + index];
         }
 
         dslice slice(const size_t __start, const size_t __end) const
@@ -96,7 +164,7 @@ namespace dv
         T & operator[] (const size_t index)
         {
             assert(_start + index < _end);
-            return (*Base::base_vector)[_start + index];
+            return _data()[_start + index];
         }
 
         const size_t size() const noexcept
@@ -104,42 +172,149 @@ namespace dv
             return _end - _start;
         }
 
+        bool sparse(const size_t ratio) const noexcept
+        {
+            // Fewer than 1 / `ratio` of the buffer's elements are viewed by any slice
+            return ratio != 0 && Base::base_vector.live() * ratio < _view().size();
+        }
+
+        void discard(const size_t index)
+        {
+            // For an element about to be left out of every slice, e.g. by an erasing split
+            assert(_start + index < _end);
+            _discard(_start + index);
+        }
+
         bool can_push_back()
         {
             //std::cout << "_end == " << _end << std::endl;
-            return _end == (Base::base_vector->size());
+            return _end == _view().elements.size() && _growable();
         }
 
         void push_back(T && element) // Should be checked before can_push_back
         {
-            Base::base_vector->push_back(std::move(element));
-            _end += 1;
+            emplace_back(std::move(element));
         }
 
         void push_back(const T & element) // Should be checked before can_push_back
         {
-            Base::base_vector->push_back(element);
+            emplace_back(element);
+        }
+
+        template<class... Args>
+        void emplace_back(Args&&... args) // Should be checked before can_push_back
+        {
+            _elements().emplace_back(std::forward<Args>(args)...);
             _end += 1;
+            Base::base_vector.live() += 1;
+        }
+
+        bool packed() const noexcept
+        {
+            // Views the whole of a vector no other slice shares
+            return _start == 0 && can_insert();
+        }
+
+        bool can_insert() const noexcept
+        {
+            // The vector is ours alone up to its end, so elements can be shifted in it
+            return _end == _view().elements.size() && _growable() && Base::base_vector.use_count() == 1;
+        }
+
+        template<class... Args>
+        void emplace(const size_t index, Args&&... args) // Should be checked before can_insert
+        {
+            assert(_start + index <= _end);
+            _elements().emplace(_elements().begin() + _start + index, std::forward<Args>(args)...);
+            _end += 1;
+            Base::base_vector.live() += 1;
+        }
+
+        bool can_push_front() const noexcept
+        {
+            // Room in front that no other slice can see
+            return _start > 0 && _growable() && Base::base_vector.use_count() == 1;
+        }
+
+        template<class E>
+        void push_front(E && element) // Should be checked before can_push_front
+        {
+            _elements()[_start - 1] = std::forward<E>(element);
+            _start -= 1;
+            Base::base_vector.live() += 1;
+        }
+
+        template<class... Args>
+        void emplace_front(Args&&... args) // Should be checked before can_push_front
+        {
+            /*
+                The slot in front holds a dead element. It is destroyed and the new one
+                constructed in its place when that cannot throw, otherwise the new one
+                is built aside and move assigned, so T must be move assignable then.
+             */
+            T & slot = _elements()[_start - 1];
+            if constexpr (std::is_nothrow_constructible_v<T, Args&&...>)
+            {
+                auto alloc = _elements().get_allocator();
+                std::allocator_traits<Allocator>::destroy(alloc, &slot);
+                std::allocator_traits<Allocator>::construct(alloc, &slot, std::forward<Args>(args)...);
+            }
+            else
+            {
+                slot = T(std::forward<Args>(args)...);
+            }
+            _start -= 1;
+            Base::base_vector.live() += 1;
+        }
+
+        void pop_front()
+        {
+            assert(_start < _end);
+            _discard(_start);
+            _start += 1;
+            Base::base_vector.live() -= 1;
+            if (_start > 2 * size() + 16 && _growable() && Base::base_vector.use_count() == 1)
+            {
+                // Mostly dead in front: drop it, amortized over the pops that made it
+                _elements().erase(_elements().begin(), _elements().begin() + _start);
+                _end -= _start;
+                _start = 0;
+            }
+        }
+
+        void pop_back()
+        {
+            assert(_start < _end);
+            _end -= 1;
+            Base::base_vector.live() -= 1;
+            if (_end + 1 == _elements().size())
+            {
+                _elements().pop_back(); // Nobody else can see it, destroy it now
+            }
+            else
+            {
+                _discard(_end);
+            }
         }
 
         iterator begin()
         {
-            return Base::base_vector->begin() + _start;
+            return _data() + _start;
         }
 
         const_iterator begin() const
         {
-            return Base::base_vector->begin() + _start;
+            return _view().data() + _start;
         }
 
         iterator end()
         {
-            return Base::base_vector->begin() + _end;
+            return _data() + _end;
         }
 
         const_iterator end() const
         {
-            return Base::base_vector->begin() + _end;
+            return _view().data() + _end;
         }
     };
-}
\ No newline at end of file
+}
@@ -0,0 +1,155 @@
+#pragma once
+
+#include <cassert>
+#include <cstddef>
+#include <new>
+#include <utility>
+#include <algorithm>
+#include <type_traits>
+
+namespace dv
+{
+    /*
+        Inline storage for the first few elements of a dvector.
+        Elements are constructed in place, no heap memory is owned.
+     */
+    template<class T, size_t N>
+    class dsmall
+    {
+    private:
+        using Self = dsmall<T, N>;
+
+        alignas(T) unsigned char storage[N * sizeof(T)];
+        size_t count = 0;
+    public:
+        static constexpr size_t capacity = N;
+
+        dsmall() noexcept
+        {
+        }
+
+        dsmall(const Self & other)
+        {
+            for (const auto & e : other)
+            {
+                new (end()) T(e);
+                count += 1;
+            }
+        }
+
+        dsmall(Self && other)
+        {
+            for (auto & e : other)
+            {
+                new (end()) T(std::move(e));
+                count += 1;
+            }
+            other.clear();
+        }
+
+        Self & operator = (const Self & other) = delete;
+        Self & operator = (Self && other) = delete;
+
+        size_t size() const noexcept
+        {
+            return count;
+        }
+
+        T * begin() noexcept
+        {
+            return std::launder(reinterpret_cast<T*>(storage));
+        }
+
+        const T * begin() const noexcept
+        {
+            return std::launder(reinterpret_cast<const T*>(storage));
+        }
+
+        T * end() noexcept
+        {
+            return begin() + count;
+        }
+
+        const T * end() const noexcept
+        {
+            return begin() + count;
+        }
+
+        T & operator[] (const size_t index)
+        {
+            assert(index < count);
+            return begin()[index];
+        }
+
+        const T & operator[] (const size_t index) const
+        {
+            assert(index < count);
+            return begin()[index];
+        }
+
+        template<class... Args>
+        void emplace(const size_t index, Args&&... args) // Should be checked against capacity before
+        {
+            assert(index <= count && count < N);
+            if (index == count)
+            {
+                new (end()) T(std::forward<Args>(args)...);
+            }
+            else
+            {
+                T element(std::forward<Args>(args)...);
+                new (end()) T(std::move(*(end() - 1)));
+                std::move_backward(begin() + index, end() - 1, end());
+                begin()[index] = std::move(element);
+            }
+            count += 1;
+        }
+
+        void erase(const size_t index)
+        {
+            assert(index < count);
+            std::move(begin() + index + 1, end(), begin() + index);
+            (end() - 1)->~T();
+            count -= 1;
+        }
+
+        void clear() noexcept
+        {
+            if constexpr (!std::is_trivially_destructible_v<T>)
+            {
+                for (auto & e : *this)
+                {
+                    e.~T();
+                }
+            }
+            count = 0;
+        }
+
+        ~dsmall()
+        {
+            clear();
+        }
+    };
+
+    template<class T>
+    class dsmall<T, 0>
+    {
+        // Inline storage disabled, every element lives in the tree
+    public:
+        static constexpr size_t capacity = 0;
+
+        size_t size() const noexcept { return 0; }
+        T * begin() noexcept { return nullptr; }
+        const T * begin() const noexcept { return nullptr; }
+        T * end() noexcept { return nullptr; }
+        const T * end() const noexcept { return nullptr; }
+
+        T & operator[] (const size_t) { assert(false); return *begin(); }
+        const T & operator[] (const size_t) const { assert(false); return *begin(); }
+
+        template<class... Args>
+        void emplace(const size_t, Args&&...) { assert(false); }
+        void erase(const size_t) { assert(false); }
+        void clear() noexcept {}
+    };
+}
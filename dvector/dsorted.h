@@ -0,0 +1,406 @@
+#pragma once
+
+#include <algorithm>
+#include <functional>
+#include <optional>
+#include <tuple>
+
+#include "dnode.h"
+#include "dvector_base.h"
+#include "dvector_iterator.h"
+#include "dmarcos.h"
+
+/*
+ *  dsorted: a dvector that keeps its elements ordered by `Compare`
+ *
+ *  structures:
+ *      1. dsorted_node extends dnode:
+ *          1. key: separator, a copy of the first element of the right subtree
+ *
+ *  Because everything in the left subtree precedes `key`, a search only
+ *  needs one comparison per level, so lower_bound, rank and insert_sorted
+ *  take a single O(log(N)) descent instead of O(log(N)) calls to operator[].
+ *
+ *  Rotations never change the first element of a right subtree, so keys
+ *  are only renewed for the element at the modified index (and the one
+ *  after it for insertions). For each element, at most one node on its
+ *  path has it as key.
+ */
+
+namespace dv
+{
+    template<class T, class Count = size_t>
+    struct dsorted_node : public basic_dnode<Count>
+    {
+        std::optional<T> key;
+    };
+
+    template<class T, class Compare = std::less<T>, class Allocator = std::allocator<T>, class Policy = default_policy>
+    class dsorted : DV_PROTECTED dvector_base<T, Allocator, Policy, dsorted_node<T, typename Policy::count_type>>
+    {
+    private:
+        using Base = dvector_base<T, Allocator, Policy, dsorted_node<T, typename Policy::count_type>>;
+        using Self = dsorted<T, Compare, Allocator, Policy>;
+        using Vector = typename Base::Vector;
+        using LeafType = typename Base::LeafType;
+        using NodeBase = typename Base::NodeBase;
+        using NodeType = dsorted_node<T, typename Policy::count_type>;
+
+        static_assert(Base::avl, "dsorted keeps its keys through rotations, it needs avl_balance");
+
+        Compare comp;
+    DV_PROTECTED:
+        bool check_height()
+        {
+            return Base::check_height(this->root);
+        }
+
+        bool check_keys() const
+        {
+            bool good = true;
+            Base::_pre_order_traverse(this->root, [&](NodeBase * ptr, int) {
+                if (ptr->type == 'n')
+                {
+                    auto n = static_cast<NodeType*>(ptr);
+                    LeafType * first;
+                    size_t local_index;
+                    std::tie(first, local_index) = Base::_access_node(n->right, 0);
+                    const T & expected = first->value[0];
+                    if (!n->key || comp(*n->key, expected) || comp(expected, *n->key))
+                    {
+                        good = false;
+                    }
+                }
+            });
+            return good;
+        }
+
+        static Vector _sorted(Vector init_vector, const Compare & comp)
+        {
+            std::stable_sort(init_vector.begin(), init_vector.end(), comp);
+            return init_vector;
+        }
+
+        void _ensure_root()
+        {
+            // Default constructed and moved-from dsorteds have no tree until their first insert
+            if (this->root == nullptr)
+            {
+                this->init_empty_root();
+            }
+        }
+
+        void _renew_key(const size_t index)
+        {
+            // Sets the key of the node whose right subtree starts at `index`, if any
+            if (index >= this->size())
+            {
+                return;
+            }
+            NodeBase * node = this->root;
+            size_t local_index = index;
+            while (node->type != 'l')
+            {
+                auto n = static_cast<NodeType*>(node);
+                if (local_index < n->left->count())
+                {
+                    node = n->left;
+                }
+                else
+                {
+                    local_index = local_index - n->left->count();
+                    if (local_index == 0)
+                    {
+                        n->key = (*this)[index];
+                        return;
+                    }
+                    node = n->right;
+                }
+            }
+        }
+
+        void _renew_keys()
+        {
+            // Sets every key, for trees built from more than one leaf at once
+            Base::_pre_order_traverse(this->root, [&](NodeBase * ptr, int) {
+                if (ptr->type == 'n')
+                {
+                    auto n = static_cast<NodeType*>(ptr);
+                    LeafType * first;
+                    size_t local_index;
+                    std::tie(first, local_index) = Base::_access_node(n->right, 0);
+                    n->key = first->value[0];
+                }
+            });
+        }
+
+        template<bool upper>
+        size_t _bound(const T & value) const
+        {
+            /*
+                lower: count of elements that are less than `value`
+                upper: count of elements that are not greater than `value`
+             */
+            const NodeBase * node = this->root;
+            size_t index = 0;
+            if (node == nullptr)
+            {
+                return 0;
+            }
+            while (node->type != 'l')
+            {
+                auto n = static_cast<const NodeType*>(node);
+                assert(n->key);
+                bool go_right = upper ? !comp(value, *n->key) : comp(*n->key, value);
+                if (go_right)
+                {
+                    index = index + n->left->count();
+                    node = n->right;
+                }
+                else
+                {
+                    node = n->left;
+                }
+            }
+            const auto & slice = static_cast<const LeafType*>(node)->value;
+            auto found = upper ?
+                std::upper_bound(slice.begin(), slice.end(), value, comp) :
+                std::lower_bound(slice.begin(), slice.end(), value, comp);
+            return index + (found - slice.begin());
+        }
+    public:
+        using iterator = dvector_iterator<T, Allocator, Policy>;
+        using const_iterator = const iterator;
+    private:
+        iterator _get_iterator(const size_t index) const
+        {
+            if (index < this->size())
+            {
+                LeafType * leaf;
+                size_t local_index;
+                std::tie(leaf, local_index) = Base::_access_node(this->root, index);
+                return iterator(leaf, this->root, local_index, index, this->size());
+            }
+            else
+            {
+                return iterator(nullptr, this->root, 0, this->size(), this->size());
+            }
+        }
+    public:
+        explicit dsorted(const Compare & comp = Compare(), const Allocator & alloc = Allocator())
+            : Base(alloc), comp(comp)
+        {
+            // Allocates nothing, the tree is built by the first insert
+        }
+
+        explicit dsorted(const Allocator & alloc)
+            : Base(alloc)
+        {
+        }
+
+        dsorted(Vector init_vector, const Compare & comp = Compare())
+            : Base(_sorted(std::move(init_vector), comp)), comp(comp)
+        {
+            // Takes over the vector, so its allocator too
+            _renew_keys();
+        }
+
+        dsorted(std::initializer_list<T> i, const Compare & comp = Compare(), const Allocator & alloc = Allocator())
+            : Base(_sorted(Vector(i, alloc), comp)), comp(comp)
+        {
+            _renew_keys();
+        }
+
+        dsorted(const Self & other)
+            : dsorted(other, std::allocator_traits<Allocator>::select_on_container_copy_construction(other.get_allocator()))
+        {
+        }
+
+        dsorted(const Self & other, const Allocator & alloc)
+            : Base(alloc), comp(other.comp)
+        {
+            if (other.root != nullptr)
+            {
+                this->root = Base::_deep_copy(other.root);
+                this->_take_balance_state(other);
+            }
+        }
+
+        dsorted(Self && other) noexcept
+            : Base(other.get_allocator()), comp(other.comp)
+        {
+            // Takes the tree, `other` is left without one like a default constructed dsorted
+            this->root = other.root;
+            this->_take_balance_state(other);
+            this->_swap_compact_state(other);
+            other.root = nullptr;
+        }
+
+        Self & operator = (const Self & other)
+        {
+            if (this != &other)
+            {
+                // Built aside first, so a throwing copy leaves this dsorted as it was
+                constexpr bool propagate = std::allocator_traits<Allocator>::propagate_on_container_copy_assignment::value;
+                Self copy(other, propagate ? other.get_allocator() : this->get_allocator());
+                std::swap(this->root, copy.root);
+                this->_take_balance_state(copy);
+                this->_swap_compact_state(copy);
+                std::swap(this->comp, copy.comp);
+                if constexpr (propagate)
+                {
+                    // `copy` frees the old tree with the allocator it came from
+                    Allocator old = this->get_allocator();
+                    this->_set_allocator(copy.get_allocator());
+                    copy._set_allocator(old);
+                }
+            }
+            return *this;
+        }
+
+        Self & operator = (Self && other) noexcept(
+            std::allocator_traits<Allocator>::propagate_on_container_move_assignment::value ||
+            std::allocator_traits<Allocator>::is_always_equal::value)
+        {
+            if (this != &other)
+            {
+                Base::_destroy_tree(this->root);
+                this->root = nullptr;
+                this->comp = other.comp;
+                if constexpr (std::allocator_traits<Allocator>::propagate_on_container_move_assignment::value)
+                {
+                    this->_set_allocator(other.get_allocator());
+                }
+                else if (this->get_allocator() != other.get_allocator())
+                {
+                    // The tree cannot change hands, move the elements one by one, they are in order already
+                    Vector v = Base::_new_vector();
+                    v.reserve(other.size());
+                    iterator it = other._get_iterator(0);
+                    for (size_t i = 0; i < other.size(); i++, ++it)
+                    {
+                        v.push_back(std::move(*it));
+                    }
+                    other._destroy_tree(other.root); // With its own allocator
+                    other.root = nullptr;
+                    if (!v.empty())
+                    {
+                        this->root = Base::_build_leaves(std::move(v));
+                        _renew_keys();
+                    }
+                    return *this;
+                }
+                this->root = other.root;
+                this->_take_balance_state(other);
+                this->_swap_compact_state(other);
+                other.root = nullptr;
+            }
+            return *this;
+        }
+
+        Allocator get_allocator() const noexcept
+        {
+            return Base::get_allocator();
+        }
+
+        size_t size() const noexcept
+        {
+            return this->root != nullptr ? Base::_count(this->root) : 0;
+        }
+
+        dmemory_usage memory_usage() const
+        {
+            return Base::_memory_usage();
+        }
+
+        dstats stats() const
+        {
+            return Base::_stats();
+        }
+
+        const T & operator[] (const size_t index) const
+        {
+            LeafType * l;
+            size_t local_index;
+            std::tie(l, local_index) = Base::_access_node(this->root, index);
+
+            return l->value[local_index];
+        }
+
+        const T & select(const size_t k) const
+        {
+            // The k-th smallest element, counting from 0
+            assert(k < this->size());
+            return (*this)[k];
+        }
+
+        size_t rank(const T & value) const
+        {
+            // Count of elements less than `value`
+            return _bound<false>(value);
+        }
+
+        size_t insert_sorted(const T & element)
+        {
+            // Inserts after any equal elements and returns the index of the new element
+            _ensure_root();
+            auto index = _bound<true>(element);
+            Base::_insert_node(this->root, index, element);
+            _renew_key(index);
+            _renew_key(index + 1);
+            return index;
+        }
+
+        size_t insert_sorted(T && element)
+        {
+            _ensure_root();
+            auto index = _bound<true>(element);
+            Base::_insert_node(this->root, index, std::move(element));
+            _renew_key(index);
+            _renew_key(index + 1);
+            return index;
+        }
+
+        void erase(const size_t index)
+        {
+            assert(index < this->size());
+            Base::_erase(this->root, index);
+            _renew_key(index);
+        }
+
+        const_iterator lower_bound(const T & value) const
+        {
+            return _get_iterator(_bound<false>(value));
+        }
+
+        const_iterator upper_bound(const T & value) const
+        {
+            return _get_iterator(_bound<true>(value));
+        }
+
+        std::string visualize(bool check = true)
+        {
+            return Base::visualize(this->root, check);
+        }
+
+        const_iterator begin() const
+        {
+            return _get_iterator(0);
+        }
+
+        const_iterator end() const
+        {
+            return _get_iterator(this->size());
+        }
+
+        const_iterator cbegin() const
+        {
+            return begin();
+        }
+
+        const_iterator cend() const
+        {
+            return end();
+        }
+    };
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <cstddef>
+#include <map>
+
+namespace dv
+{
+    struct dcounters
+    {
+        // Cumulative since the dvector was constructed, kept when Policy::stats is set
+        size_t left_rotations = 0;
+        size_t right_rotations = 0;
+        size_t rebuilds = 0; // weight_balance subtrees rebuilt perfectly balanced
+        size_t leaf_splits = 0; // A leaf replaced by two slices of its vector
+        size_t leaf_merges = 0; // Two short brother leaves copied into one
+        size_t repacks = 0; // A leaf copied out of a mostly erased vector
+        size_t node_allocations = 0;
+        size_t leaf_allocations = 0;
+    };
+
+    template<bool enabled>
+    struct dstats_state
+    {
+        // Stats off: nothing stored, counting compiles to nothing
+        void _counted(size_t dcounters::*) noexcept
+        {
+        }
+
+        dcounters _counters() const noexcept
+        {
+            return dcounters();
+        }
+    };
+
+    template<>
+    struct dstats_state<true>
+    {
+        dcounters counters;
+
+        void _counted(size_t dcounters::* counter) noexcept
+        {
+            counters.*counter += 1;
+        }
+
+        dcounters _counters() const noexcept
+        {
+            return counters;
+        }
+    };
+
+    struct dstats
+    {
+        /*
+            Shape of a dvector's tree, see stats(). Leaf sizes are in elements,
+            `leaf_fill` is the average leaf size over leaf_capacity (0 when unbounded).
+         */
+        size_t height = 0; // Edges from the root to the deepest leaf
+        size_t leaves = 0;
+        size_t inner_nodes = 0;
+        double average_leaf_size = 0;
+        double leaf_fill = 0;
+        size_t min_leaf_size = 0;
+        size_t leaf_size_p50 = 0;
+        size_t leaf_size_p90 = 0;
+        size_t leaf_size_p99 = 0;
+        size_t max_leaf_size = 0;
+        std::map<int, size_t> balance_factors; // Left height minus right height -> inner nodes
+        dcounters counters; // All zero unless Policy::stats
+    };
+}
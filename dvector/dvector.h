@@ -4,7 +4,17 @@
 #include "dslice.h"
 #include "dleaf.h"
 #include "dvector_base.h"
+#include "dweight.h"
+#include "dsmall.h"
+#include "dserial.h"
+#include "dpaged.h"
+#include "dreclaimer.h"
 #include <tuple>
+#include <cstdio>
+#include <cstdint>
+#include <type_traits>
+#include <future>
+#include <memory_resource>
 
 #include "dvector_iterator.h"
 #include "dmarcos.h"
@@ -18,6 +28,7 @@
  *          2. left: base_node
  *          3. right: base_node
  *          4. elem_count : cached count()
+ *          5. elem_weight : cached weight(), for weighted dvectors
  *      2. dleaf extends base_node:
  *          1. value: stores elements
  *      3. dnode_base:
@@ -49,57 +60,490 @@
  *          return node.value[local_index]
  *      2. _insert_node(node, index, elements) 
  *          leaf, local_index = _access_node(node, index)
- *          local_len = node.count()
- *          p = _build_parent(node)
+ *          local_len = leaf.count()
  *          
- *          if local_index == 0:
- *              p.left = new dleaf(elements)
- *                new_node.p = p
- *              p.right = leaf
- *              _rebalance(p, 1)
- *          elif local_index == local_len - 1:
- *              p.left = leaf
- *              new_node.p = p
- *              p.right = new dleaf(elements)
- *              _rebalance(p, 1)
+ *          if local_index == local_len and leaf can be appended to:
+ *              leaf.append(elements)
+ *              _fix_upward(leaf, len(elements), 0)
+ *          elif local_index == 0 or local_index == local_len:
+ *              p = _build_parent(leaf)
+ *              p.left, p.right = new dleaf(elements), leaf (or the other way round)
+ *              _fix_upward(p, len(elements), 1)
  *          else:
- *              p.left = new dleaf(node.value[0:local_index])
- *              p.right = new dleaf(elements)
- *              p.left.p = p
- *              _rebalance(p, 1)
- *              _insert_node(_get_successor(p.right), 0, leaf.value[local_index:])
+ *              p = _build_parent(leaf)
+ *              p.left = new dleaf(leaf.value[0:local_index])
+ *              p.right = right = new dleaf(leaf.value[local_index:])
+ *              _fix_upward(p, 0, 1)
+ *              q = _build_parent(right)
+ *              q.left, q.right = new dleaf(elements), right
+ *              _fix_upward(q, len(elements), 1)
  *              delete leaf
+ *      3. _fix_upward(node, count_change, height_change)
+ *          one iterative walk to the root: every ancestor's count += count_change,
+ *          balance factors and rotations while height_change != 0
  *  
  */
 
 namespace dv
 {
 
-    template<class T, class Allocator = std::allocator<T>>
-    class dvector : DV_PROTECTED dvector_base<T, Allocator>
+    template<class T, class Allocator = std::allocator<T>, class Policy = default_policy>
+    class dvector : DV_PROTECTED dvector_base<T, Allocator, Policy>
     {
     private:
-        using Base = dvector_base<T, Allocator>;
-        using Self = dvector<T, Allocator>;
+        using Base = dvector_base<T, Allocator, Policy>;
+        using Self = dvector<T, Allocator, Policy>;
         using Vector = typename Base::Vector;
         using LeafType = typename Base::LeafType;
+        using SliceType = typename Base::SliceType;
+        using BufferPtr = typename Base::BufferPtr;
+    public:
+        static constexpr size_t inline_capacity = Policy::inline_bytes / sizeof(T);
     DV_PROTECTED:
+        /*
+            Until it grows past `inline_capacity`, a dvector keeps its elements
+            in `small` and root == nullptr, so that empty and tiny dvectors own no heap memory.
+            The tree is freed again once it becomes empty.
+         */
+        dsmall<T, inline_capacity> small;
+
+        /*
+            The leftmost and rightmost leaves, cached by the operations at the ends.
+            Those go straight into the cached leaf. The head passes its change up at
+            once, the tail leaves it pending: _settle_ends passes it up the right
+            spine once, before the tree is reshaped. Until then the counts of the
+            right spine lag behind. Lookups only use the counts of left children,
+            which are exact, and size() adds what is pending, so const members
+            read the tree without writing to it. What is pending follows from the
+            counts of the tail's parent and brother, so nothing else is stored.
+         */
+        LeafType * head = nullptr;
+        LeafType * tail = nullptr;
+
         bool check_height()
         {
+            _settle_ends();
             return Base::check_height(this->root);
         }
+
+        void _settle_ends() noexcept
+        {
+            // Before the tree is reshaped: the spine catches up with the tail, and the cached leaves are forgotten
+            std::ptrdiff_t count_change, weight_change;
+            std::tie(count_change, weight_change) = _tail_pending();
+            if (count_change != 0 || weight_change != 0)
+            {
+                Base::_add_upward(tail, count_change, weight_change);
+            }
+            _forget_ends();
+        }
+
+        void _forget_ends() noexcept
+        {
+            // Once the tree is gone or handed over
+            head = nullptr;
+            tail = nullptr;
+        }
+
+        void _take_ends(Self & other) noexcept
+        {
+            // With the tree of `other`, which is left without one
+            head = other.head;
+            tail = other.tail;
+            other._forget_ends();
+        }
+
+        void _copy_ends(const Self & other) noexcept
+        {
+            // After the tree of `other` was copied, with the counts of its spine
+            std::ptrdiff_t count_change, weight_change;
+            std::tie(count_change, weight_change) = other._tail_pending();
+            if (count_change != 0 || weight_change != 0)
+            {
+                Base::_add_upward(Base::_rightmost(this->root), count_change, weight_change);
+            }
+        }
+
+        std::tuple<std::ptrdiff_t, std::ptrdiff_t> _tail_pending() const noexcept
+        {
+            /*
+                Elements and weight of the tail that its ancestors do not count yet.
+                Its brother's counts are exact, the head passes its changes up at once.
+             */
+            if (tail == nullptr || tail->p == nullptr)
+            {
+                return { 0, 0 };
+            }
+            auto p = tail->p;
+            auto brother = tail->get_brother();
+            std::ptrdiff_t count_change = static_cast<std::ptrdiff_t>(tail->value.size()) -
+                (static_cast<std::ptrdiff_t>(p->elem_count) - static_cast<std::ptrdiff_t>(Base::_count(brother)));
+            std::ptrdiff_t weight_change = 0;
+            if constexpr (Base::weighted)
+            {
+                weight_change = static_cast<std::ptrdiff_t>(tail->weight_sum) -
+                    (static_cast<std::ptrdiff_t>(p->elem_weight) - static_cast<std::ptrdiff_t>(Base::_weight(brother)));
+            }
+            return { count_change, weight_change };
+        }
+
+        LeafType * _head_leaf() noexcept
+        {
+            if (head == nullptr)
+            {
+                head = Base::_leftmost(this->root);
+            }
+            return head;
+        }
+
+        LeafType * _tail_leaf() noexcept
+        {
+            if (tail == nullptr)
+            {
+                tail = Base::_rightmost(this->root);
+            }
+            return tail;
+        }
+
+        void _end_changed(LeafType * leaf, const std::ptrdiff_t count_change, const std::ptrdiff_t weight_change) noexcept
+        {
+            // Called after `leaf` changed in place: the tail's change is left pending, the head's passed up
+            if (leaf != tail)
+            {
+                Base::_add_upward(leaf, count_change, weight_change);
+            }
+        }
+
+        template<class... Args>
+        void _emplace_back(Args&&... args)
+        {
+            if (_fits_small(1))
+            {
+                small.emplace(small.size(), std::forward<Args>(args)...);
+                return;
+            }
+            if (_is_small()) _grow(1);
+            auto leaf = _tail_leaf();
+            if (Base::_can_append(leaf, 1))
+            {
+                leaf->value.emplace_back(std::forward<Args>(args)...);
+                std::ptrdiff_t weight_change = 0;
+                if constexpr (Base::weighted)
+                {
+                    weight_change = Base::_weigh(leaf->value[leaf->value.size() - 1]);
+                    leaf->weight_sum = leaf->weight_sum + weight_change;
+                }
+                _end_changed(leaf, 1, weight_change);
+                return;
+            }
+            _settle_ends();
+            Base::_emplace_node(this->root, this->size(), std::forward<Args>(args)...);
+        }
+
+        template<class E>
+        void _push_front(E && element)
+        {
+            if (_fits_small(1))
+            {
+                small.emplace(0, std::forward<E>(element));
+                return;
+            }
+            if (_is_small()) _grow(1);
+            auto leaf = _head_leaf();
+            if (!leaf->value.can_push_front() || 
+                (Base::leaf_capacity != 0 && leaf->value.size() >= Base::leaf_capacity))
+            {
+                if constexpr (front_room != 0)
+                {
+                    leaf = _add_front_leaf(leaf->value.size());
+                }
+                else
+                {
+                    _settle_ends();
+                    Base::_insert_node(this->root, 0, std::forward<E>(element));
+                    return;
+                }
+            }
+            std::ptrdiff_t weight_change = 0;
+            if constexpr (Base::weighted)
+            {
+                weight_change = Base::_weigh(element);
+                leaf->weight_sum = leaf->weight_sum + weight_change;
+            }
+            leaf->value.push_front(std::forward<E>(element));
+            _end_changed(leaf, 1, weight_change);
+        }
+
+        /*
+            Most slots a new leftmost leaf default constructs in front, see
+            _add_front_leaf(). Value initializing trivial elements is a fill, other
+            elements pay a constructor call per slot and get less room, and without
+            a default constructor push_front inserts instead.
+         */
+        static constexpr size_t front_room = std::is_trivially_default_constructible_v<T> ? 4096 :
+            std::is_default_constructible_v<T> ? 64 : 0;
+
+        LeafType * _add_front_leaf(const size_t current)
+        {
+            /*
+                A new leftmost leaf, empty but with default constructed room in front,
+                so the following push_fronts fill it from the back. The room doubles
+                up to front_room, which keeps push_front amortized O(1) without
+                leaving much unused in front.
+             */
+            size_t room = std::min<size_t>(std::max<size_t>(2 * current, 8), front_room);
+            if (Base::leaf_capacity != 0)
+            {
+                room = std::min(room, Base::leaf_capacity);
+            }
+            _settle_ends();
+            auto fresh = this->leaf_construct(SliceType(room, room, Vector(room, this->get_allocator())));
+            if (Base::_count(this->root) == 0)
+            {
+                this->destroy(this->root);
+                this->root = fresh;
+            }
+            else
+            {
+                Base::_insert_node(this->root, 0, 0, [&](LeafType *) { return fresh; });
+            }
+            head = fresh;
+            return fresh;
+        }
+
+        void _pop_end(const bool front)
+        {
+            if (_is_small())
+            {
+                small.erase(front ? 0 : small.size() - 1);
+                return;
+            }
+            auto leaf = front ? _head_leaf() : _tail_leaf();
+            auto local_len = leaf->value.size();
+            if (local_len == 1 && leaf->p != nullptr)
+            {
+                // The leaf goes away, which reshapes the tree
+                _settle_ends();
+                Base::_erase(this->root, front ? 0 : this->size() - 1);
+                return;
+            }
+            std::ptrdiff_t weight_change = 0;
+            if constexpr (Base::weighted)
+            {
+                weight_change = -static_cast<std::ptrdiff_t>(Base::_weigh(leaf->value[front ? 0 : local_len - 1]));
+                leaf->weight_sum = leaf->weight_sum + weight_change;
+            }
+            if (front)
+            {
+                leaf->value.pop_front();
+            }
+            else
+            {
+                leaf->value.pop_back();
+            }
+            _end_changed(leaf, -1, weight_change);
+            if (leaf->p == nullptr)
+            {
+                _release_empty_root();
+            }
+        }
+
+        bool _is_small() const noexcept
+        {
+            return this->root == nullptr;
+        }
+
+        void _grow(const size_t extra)
+        {
+            /*
+                Puts the inline elements into the first leaf, reserving room for `extra`
+                more. They are copied, and dropped from `small` only once the tree
+                exists, so a throw leaves the dvector as it was. Elements that cannot be
+                copied are moved, and lost if building the leaf throws.
+             */
+            Vector v = Base::_new_vector();
+            v.reserve(small.size() + extra);
+            for (auto & e : small)
+            {
+                if constexpr (std::is_copy_constructible_v<T>)
+                {
+                    v.push_back(e);
+                }
+                else
+                {
+                    v.push_back(std::move(e));
+                }
+            }
+            this->root = Base::_build_leaves(std::move(v));
+            small.clear();
+        }
+
+        void _compact_some()
+        {
+            // Automatic compaction: one bounded step of the running sweep after an insert or erase
+            if constexpr (Base::auto_compact != 0)
+            {
+                if (_is_small())
+                {
+                    return;
+                }
+                if (this->sweep == this->idle)
+                {
+                    if (this->leaves <= Base::compact_trigger * (size() / Base::compact_leaf + 1))
+                    {
+                        return;
+                    }
+                    this->sweep = 0;
+                }
+                this->sweep = compact(this->sweep, Base::auto_compact);
+                if (this->sweep >= size())
+                {
+                    this->sweep = this->idle;
+                }
+            }
+        }
+
+        bool _fits_small(const size_t extra) const noexcept
+        {
+            return _is_small() && small.size() + extra <= inline_capacity;
+        }
+
+        void _release_empty_root()
+        {
+            if (!_is_small() && size() == 0)
+            {
+                this->destroy(this->root);
+                this->root = nullptr;
+                _forget_ends();
+            }
+        }
+
+        void _clear() noexcept
+        {
+            Base::_destroy_tree(this->root);
+            this->root = nullptr;
+            _forget_ends();
+            small.clear();
+        }
+
+        template<class Elements>
+        void _init(Elements && init_vector)
+        {
+            if (init_vector.size() <= inline_capacity)
+            {
+                for (auto & e : init_vector)
+                {
+                    if constexpr (std::is_lvalue_reference_v<Elements>)
+                        small.emplace(small.size(), e);
+                    else
+                        small.emplace(small.size(), std::move(e));
+                }
+                if constexpr (!std::is_lvalue_reference_v<Elements>)
+                {
+                    init_vector.clear(); // Moved from, like the vector a leaf would have taken
+                }
+            }
+            else if constexpr (std::is_lvalue_reference_v<Elements>)
+            {
+                this->root = Base::_build_leaves(Vector(init_vector, this->get_allocator()));
+            }
+            else
+            {
+                this->root = Base::_build_leaves(std::move(init_vector));
+            }
+        }
+
+        template<class Elements>
+        void _insert_chunked(const size_t index, Elements && elements)
+        {
+            // One leaf_capacity sized chunk after another, each one becomes a leaf
+            for (size_t start = 0; start < elements.size(); start += Base::leaf_capacity)
+            {
+                auto first = elements.begin() + start;
+                auto last = elements.begin() + std::min(elements.size(), start + Base::leaf_capacity);
+                if constexpr (std::is_lvalue_reference_v<Elements>)
+                    Base::_insert_node(this->root, index + start, Vector(first, last, this->get_allocator()));
+                else
+                    Base::_insert_node(this->root, index + start, 
+                        Vector(std::make_move_iterator(first), std::make_move_iterator(last), this->get_allocator()));
+            }
+        }
+
+        // Leaves of compact_leaf elements read from a stream per batch, so one vector and one read serve many
+        static constexpr size_t stream_batch_leaves = 64;
+
+        void _append_batch(Vector && batch)
+        {
+            if (batch.empty())
+            {
+                return;
+            }
+            if (_fits_small(batch.size()))
+            {
+                for (auto & e : batch)
+                {
+                    small.emplace(small.size(), std::move(e));
+                }
+                return;
+            }
+            if (_is_small() && small.size() > 0) _grow(0);
+            _settle_ends();
+            Base::_append_leaves(std::move(batch));
+        }
+
+        template<class Source>
+        size_t _append_from(const Source & source, size_t max_elements, const bool pipelined)
+        {
+            /*
+                `source(data, count)` reads up to `count` elements and returns how many,
+                fewer only at the end. Batch vectors are allocated here, on the calling
+                thread, a pipelined read only fills the next one while this one is
+                hung on the tree.
+             */
+            static_assert(std::is_trivially_copyable_v<T>, "append_from() reads the bytes of the elements");
+            const size_t batch_elements = stream_batch_leaves * Base::compact_leaf;
+            size_t appended = 0;
+            size_t count = std::min(max_elements, batch_elements);
+            Vector batch(count, this->get_allocator());
+            batch.resize(source(batch.data(), count));
+            while (true)
+            {
+                bool more = batch.size() == count && count < max_elements;
+                max_elements -= batch.size();
+                appended += batch.size();
+                count = std::min(max_elements, batch_elements);
+
+                Vector next(more ? count : 0, this->get_allocator());
+                std::future<size_t> pending;
+                if (more && pipelined)
+                {
+                    pending = std::async(std::launch::async, [&source, &next]() { return source(next.data(), next.size()); });
+                }
+                _append_batch(std::move(batch));
+                if (!more)
+                {
+                    return appended;
+                }
+                next.resize(pipelined ? pending.get() : source(next.data(), next.size()));
+                batch = std::move(next);
+            }
+        }
     public:
-        using iterator = dvector_iterator<T, Allocator>;
+        using iterator = dvector_iterator<T, Allocator, Policy>;
         using const_iterator = const iterator;
     private:
         iterator _get_begin_iterator() const
         {
-            if (this->size() > 0)
+            if (_is_small())
+            {
+                return iterator(const_cast<T*>(small.begin()), 0);
+            }
+            else if (this->size() > 0)
             {
                 LeafType * left_most;
                 size_t local_index;
                 std::tie(left_most, local_index) = Base::_access_node(Base::root, 0);
-                return iterator(left_most, Base::root, 0, 0);
+                return iterator(left_most, Base::root, 0, 0, this->size());
             }
             else
             {
@@ -109,73 +553,421 @@ namespace dv
 
         iterator _get_end_iterator() const
         {
-            return iterator(nullptr, Base::root, 0, this->size());
+            if (_is_small())
+            {
+                return iterator(const_cast<T*>(small.begin()), small.size());
+            }
+            return iterator(nullptr, Base::root, 0, this->size(), this->size());
         }
     public:
-        dvector() : Base(Vector{})
+        dvector()
         {
         }
 
-        dvector(const Vector & init_vector) : Base(init_vector) 
+        explicit dvector(const Allocator & alloc)
+            : Base(alloc)
         {
         }
 
-        dvector(Vector && init_vector) : Base(std::move(init_vector))
+        dvector(const Vector & init_vector, const Allocator & alloc = Allocator())
+            : Base(alloc)
         {
+            _init(init_vector);
+        }
+
+        dvector(Vector && init_vector)
+            : Base(init_vector.get_allocator())
+        {
+            // Takes over the vector, so its allocator too
+            _init(std::move(init_vector));
         }
 
         dvector(const Self & other)
+            : Base(std::allocator_traits<Allocator>::select_on_container_copy_construction(other.get_allocator())), 
+            small(other.small)
         {
             // std::cout << "Deep copy is called! " << std::endl;
-            this->root = Base::_deep_copy(other.root);
+            if (!other._is_small())
+            {
+                this->root = Base::_deep_copy(other.root);
+                _copy_ends(other);
+                this->_take_balance_state(other);
+            }
+        }
+
+        dvector(std::initializer_list<T> i, const Allocator & alloc = Allocator())
+            : Base(alloc)
+        {
+            _init(Vector(i, alloc));
         }
 
-        dvector(std::initializer_list<T> i)
-            : Base(Vector(i))
+        template<class Deleter>
+        dvector(T * data, const size_t n, Deleter deleter, const Allocator & alloc = Allocator())
+            : Base(alloc)
         {
+            // Views the `n` elements at `data` without copying them, see insert_adopted
+            insert_adopted(0, data, n, std::move(deleter));
         }
 
         Self & operator = (const Self & other)
         {
             if (this != &other)
             {
-                this->root = Base::_deep_copy(other.root);
+                _clear();
+                if constexpr (std::allocator_traits<Allocator>::propagate_on_container_copy_assignment::value)
+                {
+                    this->_set_allocator(other.get_allocator());
+                }
+                for (const auto & e : other.small)
+                {
+                    small.emplace(small.size(), e);
+                }
+                if (!other._is_small())
+                {
+                    this->root = Base::_deep_copy(other.root);
+                    _copy_ends(other);
+                    this->_take_balance_state(other);
+                }
             }
             return *this;
         }
 
         dvector(Self && other)
+            : Base(other.get_allocator()), small(std::move(other.small))
         {
             this->root = other.root;
-            other.init_empty_root();
+            _take_ends(other);
+            this->_take_balance_state(other);
+            this->_swap_compact_state(other);
+            other.root = nullptr;
         }
 
         Self & operator = (Self && other)
         {
             if (this != &other)
             {
+                _clear();
+                if constexpr (std::allocator_traits<Allocator>::propagate_on_container_move_assignment::value)
+                {
+                    this->_set_allocator(other.get_allocator());
+                }
+                else if (this->get_allocator() != other.get_allocator())
+                {
+                    // The tree cannot change hands, move the elements one by one
+                    Vector v = Base::_new_vector();
+                    v.reserve(other.size());
+                    for (auto it = other.begin(); it != other.end(); ++it)
+                    {
+                        v.push_back(std::move(*it));
+                    }
+                    other._clear();
+                    _init(std::move(v));
+                    return *this;
+                }
+                for (auto & e : other.small)
+                {
+                    small.emplace(small.size(), std::move(e));
+                }
+                other.small.clear();
                 this->root = other.root;
-                other.init_empty_root();
+                _take_ends(other);
+                this->_take_balance_state(other);
+                this->_swap_compact_state(other);
+                other.root = nullptr;
             }
             return *this;
         }
 
+        ~dvector()
+        {
+            _clear();
+        }
+
         size_t size() const noexcept
         {
-            return this->root->count();
+            return _is_small() ? small.size() : Base::_count(this->root) + std::get<0>(_tail_pending());
+        }
+
+        void clear() noexcept
+        {
+            _clear();
+        }
+
+        dmemory_usage memory_usage() const
+        {
+            // Walks the whole tree, O(N / leaf size)
+            return Base::_memory_usage();
+        }
+
+        dstats stats() const
+        {
+            // Shape of the tree, O(N / leaf size), and the counters kept when Policy::stats is set
+            return Base::_stats();
+        }
+
+        void shrink_to_fit()
+        {
+            // Moves every leaf out of a vector that is mostly erased, so that the vector is freed
+            if (!_is_small())
+            {
+                _settle_ends();
+                Base::_repack_all();
+            }
+        }
+
+        void compact()
+        {
+            /*
+                Rebuilds the tree in O(N): every element is moved, in order, into full
+                leaves of vectors of their own, under a perfectly balanced tree.
+             */
+            if (!_is_small())
+            {
+                _settle_ends();
+                Base::_compact();
+            }
+        }
+
+        size_t compact(size_t from, const size_t max_elements)
+        {
+            /*
+                Incremental compaction: packs runs of short leaves from the one holding
+                `from` on, until about `max_elements` elements were visited. Returns
+                where to continue, size() once the end is reached. The dvector may be
+                used and changed between calls, the tree stays balanced throughout.
+             */
+            if (_is_small() || from >= size())
+            {
+                return size();
+            }
+            _settle_ends();
+            size_t total = size();
+            size_t visited = 0;
+            while (from < total && visited < max_elements)
+            {
+                size_t next = Base::_compact_step(from);
+                visited += next - from;
+                from = next;
+            }
+            return from;
+        }
+
+        void save(std::ostream & out) const
+        {
+            /*
+                Writes the dvector in the format of dserial.h: the sizes of its leaves,
+                then each leaf as one block. O(N / leaf size) writes.
+             */
+            static_assert(std::is_trivially_copyable_v<T>, "save() writes the bytes of the elements");
+            std::vector<uint64_t> sizes;
+            std::vector<const LeafType*> blocks;
+            if (_is_small())
+            {
+                if (small.size() > 0) sizes.push_back(small.size());
+            }
+            else
+            {
+                std::vector<typename Base::NodeBase*> leaves;
+                std::vector<typename Base::Node*> inner;
+                Base::_collect(this->root, leaves, inner);
+                for (auto leaf : leaves)
+                {
+                    auto l = static_cast<const LeafType*>(leaf);
+                    if (l->value.size() > 0)
+                    {
+                        sizes.push_back(l->value.size());
+                        blocks.push_back(l);
+                    }
+                }
+            }
+
+            dfile_header header;
+            header.element_size = sizeof(T);
+            header.elements = size();
+            header.leaves = sizes.size();
+            _write_raw(out, &header, 1);
+            _write_raw(out, sizes.data(), sizes.size());
+            if (_is_small())
+            {
+                _write_raw(out, small.begin(), small.size());
+            }
+            for (auto leaf : blocks)
+            {
+                // Reached right before it is written, a paged leaf may not stay in memory for long
+                _write_raw(out, &leaf->value[0], leaf->value.size());
+            }
+        }
+
+        static Self load(std::istream & in, const Allocator & alloc = Allocator())
+        {
+            /*
+                Reads what save() wrote. The elements are read in one block into a
+                single vector, and the leaves are built as slices of it with the saved
+                sizes under a perfectly balanced tree: nothing is done per element.
+                Paged dvectors read a leaf at a time instead, each into its own page.
+                Throws std::exception on a malformed or mismatching stream.
+             */
+            static_assert(std::is_trivially_copyable_v<T>, "load() reads the bytes of the elements");
+            dfile_header header;
+            _read_raw(in, &header, 1);
+            if (!header.valid(sizeof(T)))
+            {
+                throw std::exception();
+            }
+            /*
+                Nothing is allocated for more than the stream holds. When its length is
+                unknown, the vectors grow as the data arrives instead, see _read_vector().
+             */
+            uint64_t remaining = _remaining_bytes(in);
+            const bool known_length = remaining != UINT64_MAX;
+            if (header.leaves > remaining / sizeof(uint64_t) ||
+                header.elements > (remaining - header.leaves * sizeof(uint64_t)) / sizeof(T) ||
+                header.elements > SIZE_MAX / sizeof(T))
+            {
+                throw std::exception();
+            }
+            std::vector<uint64_t> sizes;
+            _read_vector(in, sizes, header.leaves, known_length);
+            uint64_t total = 0;
+            for (auto size : sizes)
+            {
+                if (size == 0 || size > header.elements - total) // No wrapping around to a matching total
+                {
+                    throw std::exception();
+                }
+                total += size;
+            }
+            if (total != header.elements)
+            {
+                throw std::exception();
+            }
+            Self loaded(alloc);
+            if (Base::paged && header.elements > inline_capacity)
+            {
+                // A leaf at a time, so no more than the cache's budget is ever in memory
+                for (auto size : sizes)
+                {
+                    Vector part(alloc);
+                    _read_vector(in, part, size, known_length);
+                    loaded._append_batch(std::move(part));
+                }
+                return loaded;
+            }
+            Vector elements(alloc);
+            _read_vector(in, elements, header.elements, known_length);
+            if (elements.size() <= inline_capacity)
+            {
+                loaded._init(std::move(elements));
+            }
+            else
+            {
+                loaded.root = loaded._build_leaves(std::move(elements), sizes);
+            }
+            return loaded;
+        }
+
+        size_t append_from(std::istream & in, const size_t max_elements = SIZE_MAX, const bool pipelined = false)
+        {
+            /*
+                Appends the elements read from `in` as raw records of sizeof(T) bytes, 
+                until its end or `max_elements`. Records are read in batches of many
+                leaves, and the leaves are filled to compact_leaf and hung on the right
+                spine as they are: nothing is done per element. With `pipelined` the
+                next batch is read on another thread while this one is appended.
+                Returns how many were appended. Throws std::exception on a read error
+                or a truncated last record, what was appended before stays.
+             */
+            return _append_from([&in](T * data, const size_t count)
+            {
+                in.read(reinterpret_cast<char*>(data), static_cast<std::streamsize>(count * sizeof(T)));
+                auto bytes = static_cast<size_t>(in.gcount());
+                if (in.bad() || bytes % sizeof(T) != 0)
+                {
+                    throw std::exception();
+                }
+                return bytes / sizeof(T);
+            }, max_elements, pipelined);
+        }
+
+        size_t append_from(std::FILE * file, const size_t max_elements = SIZE_MAX, const bool pipelined = false)
+        {
+            // The same from a C stream, for a file descriptor through fdopen()
+            return _append_from([file](T * data, const size_t count)
+            {
+                auto bytes = std::fread(data, 1, count * sizeof(T), file);
+                if (std::ferror(file) || bytes % sizeof(T) != 0)
+                {
+                    throw std::exception();
+                }
+                return bytes / sizeof(T);
+            }, max_elements, pipelined);
+        }
+
+        std::future<void> clear_async()
+        {
+            /*
+                Detaches the tree and hands it to the reclaimer thread, see dreclaimer.
+                The dvector is empty and usable at once, the future is ready once the
+                memory is back. Elements are destroyed on that thread. Only with an
+                allocator known to be thread-safe and shared_ownership: otherwise, or
+                while the reclaimer is full, the tree is cleared here and the future is
+                ready on return.
+             */
+            if constexpr (!is_thread_safe_allocator_v<Allocator> || 
+                !std::is_same_v<typename Base::Ownership, shared_ownership>)
+            {
+                clear();
+                std::promise<void> done;
+                done.set_value();
+                return done.get_future();
+            }
+            if (this->root == nullptr)
+            {
+                small.clear();
+                std::promise<void> done;
+                done.set_value();
+                return done.get_future();
+            }
+            // Everything that may throw comes before the tree is detached
+            auto & reclaimer = dreclaimer::instance();
+            std::packaged_task<void()> teardown([detached = this->root, alloc = this->get_allocator()]
+            {
+                Base lender(alloc); // Empty, only lends its allocators
+                lender._destroy_tree(detached);
+            });
+            auto freed = teardown.get_future();
+
+            this->root = nullptr;
+            this->_reset_compact_state(); // Its leaves are freed by `teardown`
+            _forget_ends();
+            if (!reclaimer.post(teardown))
+            {
+                teardown();
+            }
+            return freed;
         }
 
         const T & operator[] (const size_t index) const
         {
+            if (_is_small())
+            {
+                return small[index];
+            }
+
             LeafType * l;
             size_t local_index;
             std::tie(l, local_index) = Base::_access_node(Base::root, index);
 
-            return l->value[local_index];
+            return static_cast<const LeafType*>(l)->value[local_index]; // A read, leaves a paged vector clean
         }
 
         T & operator[] (const size_t index)
         {
+            if (_is_small())
+            {
+                return small[index];
+            }
+
             LeafType * l;
             size_t local_index;
             std::tie(l, local_index) = Base::_access_node(Base::root, index);
@@ -185,47 +977,242 @@ namespace dv
 
         std::string visualize(bool check = true)
         {
+            _settle_ends();
             return Base::visualize(this->root, check);
         }
 
         void insert(const size_t index, const Vector & elements)
         {
             assert(index <= this->size());
-            Base::_insert_node(this->root, index, elements);
+            if (elements.empty())
+            {
+                return; // An empty leaf must not end up at either end, where push and pop trust the cached leaves
+            }
+            if (_fits_small(elements.size()))
+            {
+                for (size_t i = 0; i < elements.size(); i++)
+                {
+                    small.emplace(index + i, elements[i]);
+                }
+                return;
+            }
+            if (_is_small()) _grow(elements.size());
+            _settle_ends();
+            if (Base::leaf_capacity != 0 && elements.size() > Base::leaf_capacity)
+            {
+                _insert_chunked(index, elements);
+            }
+            else
+            {
+                Base::_insert_node(this->root, index, elements);
+            }
+            _compact_some();
         }
 
         void insert(const size_t index, Vector && elements)
         {
             assert(index <= this->size());
-            Base::_insert_node(this->root, index, std::move(elements));
+            if (elements.empty())
+            {
+                return; // An empty leaf must not end up at either end, where push and pop trust the cached leaves
+            }
+            if (_fits_small(elements.size()))
+            {
+                for (size_t i = 0; i < elements.size(); i++)
+                {
+                    small.emplace(index + i, std::move(elements[i]));
+                }
+                return;
+            }
+            if (_is_small()) _grow(elements.size());
+            _settle_ends();
+            if (Base::leaf_capacity != 0 && elements.size() > Base::leaf_capacity)
+            {
+                _insert_chunked(index, std::move(elements));
+            }
+            else
+            {
+                Base::_insert_node(this->root, index, std::move(elements));
+            }
+            _compact_some();
         }
 
-        void insert(const size_t index, const T & element)
+        template<class Deleter>
+        void insert_adopted(const size_t index, T * data, const size_t n, Deleter deleter)
         {
+            /*
+                Inserts the `n` elements at `data` without copying them: they become
+                leaves of compact_leaf elements viewing that memory, which `deleter(data)`
+                gets back once no leaf views it, or at once on failure. The dvector owns
+                the elements from the call on. Assignments change them in place, an
+                insertion inside one of those leaves copies that leaf out, and so do
+                compact() and repacking for all of them.
+             */
             assert(index <= this->size());
-            Base::_insert_node(this->root, index, element);
+            auto buffer = Base::_adopted_buffer(data, n, std::move(deleter));
+            if (n == 0)
+            {
+                return;
+            }
+            if (_is_small() && small.size() > 0) _grow(0);
+            _settle_ends();
+            for (size_t start = 0; start < n; start += Base::compact_leaf)
+            {
+                auto end = std::min(n, start + Base::compact_leaf);
+                Base::_insert_leaf(index + start, 
+                    Base::_weigh_leaf(this->leaf_construct(SliceType(start, end, buffer))));
+            }
+            _compact_some();
+        }
+
+        void insert(const size_t index, const T & element)
+        {
+            emplace(index, element);
         }
 
         void insert(const size_t index, T && element)
+        {
+            emplace(index, std::move(element));
+        }
+
+        template<class... Args>
+        void emplace(const size_t index, Args&&... args)
         {
             assert(index <= this->size());
-            Base::_insert_node(this->root, index, std::move(element));
+            if (_fits_small(1))
+            {
+                small.emplace(index, std::forward<Args>(args)...);
+                return;
+            }
+            if (_is_small()) _grow(1);
+            _settle_ends();
+            Base::_emplace_node(this->root, index, std::forward<Args>(args)...);
+            _compact_some();
         }
 
         void push_back(const T & element)
         {
-            insert(this->size(), element);
+            _emplace_back(element);
         }
 
         void push_back(T && element)
         {
-            insert(this->size(), std::move(element));
+            _emplace_back(std::move(element));
+        }
+
+        template<class... Args>
+        void emplace_back(Args&&... args)
+        {
+            _emplace_back(std::forward<Args>(args)...);
+        }
+
+        void push_front(const T & element)
+        {
+            _push_front(element);
+        }
+
+        void push_front(T && element)
+        {
+            _push_front(std::move(element));
+        }
+
+        void pop_front()
+        {
+            assert(this->size() > 0);
+            _pop_end(true);
+        }
+
+        void pop_back()
+        {
+            assert(this->size() > 0);
+            _pop_end(false);
         }
 
         void erase(const size_t index)
         {
             assert(index < this->size());
+            if (_is_small())
+            {
+                small.erase(index);
+                return;
+            }
+            _settle_ends();
             Base::_erase(this->root, index);
+            _release_empty_root();
+            _compact_some();
+        }
+
+        void replace(const size_t index, const T & element)
+        {
+            replace(index, T(element));
+        }
+
+        void replace(const size_t index, T && element)
+        {
+            assert(index < this->size());
+            if (_is_small())
+            {
+                small[index] = std::move(element);
+                return;
+            }
+            Base::_replace(this->root, index, std::move(element));
+        }
+
+        template<class Modifier>
+        void modify(const size_t index, Modifier modifier)
+        {
+            /*
+                Calls modifier(element) on the element at `index`. A weighted dvector
+                weighs it again afterwards, which writing through operator[] or an
+                iterator does not.
+             */
+            assert(index < this->size());
+            if (_is_small())
+            {
+                modifier(small[index]);
+                return;
+            }
+            Base::_modify(this->root, index, modifier);
+        }
+
+        size_t total_weight() const noexcept
+        {
+            static_assert(Base::weighted, "total_weight() requires a weighted dvector");
+            return _is_small() ? offset_of(small.size()) : this->root->weight() + std::get<1>(_tail_pending());
+        }
+
+        size_t offset_of(const size_t index) const
+        {
+            static_assert(Base::weighted, "offset_of() requires a weighted dvector");
+            assert(index <= this->size());
+            if (_is_small())
+            {
+                size_t before = 0;
+                for (size_t i = 0; i < index; i++)
+                {
+                    before = before + Base::_weigh(small[i]);
+                }
+                return before;
+            }
+            return Base::_weight_before(this->root, index);
+        }
+
+        std::tuple<size_t, size_t> find_offset(const size_t offset) const
+        {
+            static_assert(Base::weighted, "find_offset() requires a weighted dvector");
+            assert(offset < this->total_weight());
+            if (_is_small())
+            {
+                size_t index = 0;
+                size_t local_offset = offset;
+                while (local_offset >= Base::_weigh(small[index]))
+                {
+                    local_offset = local_offset - Base::_weigh(small[index]);
+                    index = index + 1;
+                }
+                return std::make_tuple(index, local_offset);
+            }
+            return Base::_access_weight(this->root, offset);
         }
 
         iterator begin()
@@ -258,4 +1245,21 @@ namespace dv
             return _get_end_iterator();
         }
     };
+
+    template<class T, class Weigher = size_weight, class Allocator = std::allocator<T>>
+    using dweighted = dvector<T, Allocator, weighted_policy<Weigher>>;
+}
+
+namespace dv::pmr
+{
+    // A dvector whose leaves, nodes and buffers all come from one std::pmr::memory_resource
+    template<class T, class Policy = default_policy>
+    using dvector = dv::dvector<T, std::pmr::polymorphic_allocator<T>, Policy>;
+}
+
+namespace dv::paged
+{
+    // A dvector whose leaf vectors are paged out to the file of a dpage_cache, see dpaged.h
+    template<class T, class Policy = paged_policy>
+    using dvector = dv::dvector<T, dpaged_allocator<T>, Policy>;
 }
\ No newline at end of file
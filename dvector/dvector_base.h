@@ -6,45 +6,189 @@
 #include "dslice.h"
 #include "dleaf.h"
 #include "dalloc.h"
-#include <functional>
+#include "dweight.h"
+#include "dpolicy.h"
+#include <cmath>
+#include <new>
+#include <type_traits>
 #include <sstream>
 #include <algorithm>
+#include <unordered_set>
 
 #define DV_CHECKH(x) assert(((x)->h <= 1) && ((x)->h >= -1));
 
 namespace dv
 {
-    template<class T, class Allocator = std::allocator<T>>
-    struct dvector_base : public dvector_alloc_base<T, Allocator>
+    template<bool avl>
+    struct dbalance_state
+    {
+        // avl_balance keeps its state in the nodes
+    };
+
+    template<>
+    struct dbalance_state<false>
+    {
+        size_t leaf_total = 1; // Leaves in the tree, one more than its inner nodes
+        size_t leaf_max = 1; // Most leaves since the last full rebuild
+    };
+
+    template<class T, class Allocator = std::allocator<T>, class Policy = default_policy, 
+        class NodeType = basic_dnode<typename Policy::count_type>>
+    struct dvector_base : 
+        public dvector_alloc_base<T, Allocator, NodeType, typename Policy::buffer_ownership, Policy::stats, Policy::auto_compact != 0>, 
+        public dbalance_state<std::is_same_v<typename Policy::balance, avl_balance>>
     {
     public:
         using Vector = std::vector<T, Allocator>;
         using ElemType = T;
-        using LeafType = dleaf<T, Allocator>;
-        using SliceType = dslice<T, Allocator>;
-
-        dnode_base * root;
+        using Count = typename Policy::count_type;
+        using Weigher = typename Policy::weigher;
+        using NodeBase = basic_dnode_base<Count>;
+        using Node = basic_dnode<Count>;
+        using Ownership = typename Policy::buffer_ownership;
+        using LeafType = dleaf<T, Allocator, Count, Ownership>;
+        using SliceType = dslice<T, Allocator, Ownership>;
+        using BufferPtr = typename SliceType::BufferPtr;
+        using AllocBase = dvector_alloc_base<T, Allocator, NodeType, Ownership, Policy::stats, Policy::auto_compact != 0>;
+
+        static constexpr bool weighted = is_weighted_v<Weigher>;
+        // A buffer is a page, which must not outgrow the cache's budget: no leaves share one
+        static constexpr bool paged = std::is_same_v<Ownership, paged_ownership>;
+        static constexpr bool avl = std::is_same_v<typename Policy::balance, avl_balance>;
+        static constexpr size_t leaf_capacity = Policy::leaf_capacity;
+        static constexpr size_t repack_ratio = Policy::repack_ratio;
+        // Longest leaf a single insert shifts in place rather than splitting it
+        static constexpr size_t shift_limit = leaf_capacity != 0 ? leaf_capacity : 64;
+        // Size of the leaves compaction builds, about a page when leaves are unbounded
+        static constexpr size_t compact_leaf = leaf_capacity != 0 ? leaf_capacity : 
+            std::max<size_t>(shift_limit, 4096 / sizeof(T));
+        // Elements automatic compaction packs per insert or erase, see dpolicy.h
+        static constexpr size_t auto_compact = Policy::auto_compact;
+        // A sweep starts once there are this many times more leaves than a compacted tree has
+        static constexpr size_t compact_trigger = 4;
+        // Compaction moves the elements only if that cannot throw, or if they cannot be copied
+        static constexpr bool compact_moves = (std::is_nothrow_move_constructible_v<T> && 
+            std::is_nothrow_move_assignable_v<T>) || !std::is_copy_constructible_v<T>;
+
+        NodeBase * root;
 
         dvector_base() : root(nullptr)
         {
         }
 
+        explicit dvector_base(const Allocator & alloc) 
+            : AllocBase(alloc), root(nullptr)
+        {
+        }
+
         dvector_base(const Vector & init_vector)
+            : AllocBase(init_vector.get_allocator())
         {
-            root = this->leaf_construct(SliceType(0, init_vector.size(), init_vector));
+            root = _build_leaves(Vector(init_vector));
         }
 
         dvector_base(Vector && init_vector)
+            : AllocBase(init_vector.get_allocator())
+        {
+            root = _build_leaves(std::move(init_vector));
+        }
+
+        Vector _new_vector() const
         {
-            root = this->leaf_construct(SliceType(0, init_vector.size(), std::move(init_vector)));
+            // Empty, with the container's allocator
+            return Vector(this->get_allocator());
         }
 
         void init_empty_root()
         {
-            root = this->leaf_construct(SliceType(0, 0, Vector()));
+            root = this->leaf_construct(SliceType(0, 0, _new_vector()));
+            _reset_balance_state(1);
+        }
+
+        static Count _count(const NodeBase * node) noexcept
+        {
+            // count() without the virtual call
+            if (node->type == 'l')
+            {
+                return static_cast<Count>(static_cast<const LeafType*>(node)->value.size());
+            }
+            return static_cast<const Node*>(node)->elem_count;
+        }
+
+        static Count _weight(const NodeBase * node) noexcept
+        {
+            // weight() without the virtual call
+            if (node->type == 'l')
+            {
+                return static_cast<const LeafType*>(node)->weight_sum;
+            }
+            return static_cast<const Node*>(node)->elem_weight;
+        }
+
+        static void _renew(Node * p) noexcept
+        {
+            // Recomputes the count and weight of `p` from its children only
+            p->elem_count = _count(p->left) + _count(p->right);
+            if constexpr (weighted)
+            {
+                p->elem_weight = _weight(p->left) + _weight(p->right);
+            }
+        }
+
+        static size_t _weigh(const T & element)
+        {
+            if constexpr (weighted)
+            {
+                return Weigher()(element);
+            }
+            else
+            {
+                return 0;
+            }
         }
 
-        void _replace_node(dnode_base * new_node, dnode_base * old_node)
+        static size_t _weigh(const SliceType & slice, const size_t start, const size_t end)
+        {
+            size_t w = 0;
+            if constexpr (weighted)
+            {
+                for (size_t i = start; i < end; i++)
+                {
+                    w += _weigh(slice[i]);
+                }
+            }
+            return w;
+        }
+
+        static size_t _weigh_prefix(const LeafType * leaf, const size_t local_index)
+        {
+            // Weight of leaf->value[0, local_index), summing whichever side is shorter
+            auto local_len = leaf->value.size();
+            if (local_index <= local_len / 2)
+            {
+                return _weigh(leaf->value, 0, local_index);
+            }
+            else
+            {
+                return leaf->weight_sum - _weigh(leaf->value, local_index, local_len);
+            }
+        }
+
+        static LeafType * _weigh_leaf(LeafType * leaf, const size_t weight)
+        {
+            if constexpr (weighted)
+            {
+                leaf->weight_sum = weight;
+            }
+            return leaf;
+        }
+
+        static LeafType * _weigh_leaf(LeafType * leaf)
+        {
+            return _weigh_leaf(leaf, _weigh(leaf->value, 0, leaf->value.size()));
+        }
+
+        void _replace_node(NodeBase * new_node, NodeBase * old_node)
         {
             // The place of old_node is taken by new_node
             
@@ -63,7 +207,7 @@ namespace dv
             }
         }
 
-        dnode * _build_parent(LeafType * leaf)
+        Node * _build_parent(LeafType * leaf)
         {
             /*       o                   o
                     / \                 / \
@@ -71,12 +215,415 @@ namespace dv
                                       / \
                                    null null
              */
-            dnode * p = this->node_construct();
+            Node * p = this->node_construct();
             _replace_node(p, leaf);
             return p;
         }
 
-        dnode_base * left_rotate(dnode * x)
+        NodeBase * _build_balanced(NodeBase * const * leaves, const size_t n, int & height)
+        {
+            /*
+                Perfectly balanced subtree over leaves[0, n). The left side takes
+                the extra leaf, so every balance factor is 0 or 1.
+             */
+            if (n == 1)
+            {
+                height = 0;
+                return leaves[0];
+            }
+            int left_height, right_height;
+            auto left = _build_balanced(leaves, n - n / 2, left_height);
+            NodeBase * right = nullptr;
+            Node * p;
+            try
+            {
+                right = _build_balanced(leaves + (n - n / 2), n / 2, right_height);
+                p = this->node_construct();
+            }
+            catch (...)
+            {
+                // The leaves stay with the caller, the inner nodes built so far are freed
+                _destroy_inner(left);
+                if (right != nullptr)
+                {
+                    _destroy_inner(right);
+                }
+                throw;
+            }
+            p->set_left(left);
+            p->set_right(right);
+            p->elem_count = _count(left) + _count(right);
+            if constexpr (weighted)
+            {
+                p->elem_weight = _weight(left) + _weight(right);
+            }
+            p->h = left_height - right_height;
+            height = std::max(left_height, right_height) + 1;
+            return p;
+        }
+
+        void _destroy_inner(NodeBase * node) noexcept
+        {
+            // Frees the inner nodes of a subtree and leaves its leaves alone
+            if (node->type == 'n')
+            {
+                auto n = static_cast<Node*>(node);
+                _destroy_inner(n->left);
+                _destroy_inner(n->right);
+                this->node_destroy(static_cast<NodeType*>(n));
+            }
+        }
+
+        std::vector<NodeBase*> _cut_leaves(Vector && elements, const std::vector<size_t> & ends)
+        {
+            /*
+                Leaves over `elements`, the i-th one ending at ends[i]. They all view
+                the same buffer, except paged ones which move their part into a vector
+                of their own, so that a page is never larger than a leaf.
+             */
+            std::vector<NodeBase*> leaves;
+            leaves.reserve(ends.size());
+            if (paged && ends.size() > 1)
+            {
+                size_t start = 0;
+                for (auto end : ends)
+                {
+                    Vector part(std::make_move_iterator(elements.begin() + start), 
+                        std::make_move_iterator(elements.begin() + end), this->get_allocator());
+                    leaves.push_back(_weigh_leaf(this->leaf_construct(SliceType(0, end - start, BufferPtr(std::move(part))))));
+                    start = end;
+                }
+                return leaves;
+            }
+            BufferPtr buffer(std::move(elements));
+            size_t start = 0;
+            for (auto end : ends)
+            {
+                leaves.push_back(_weigh_leaf(this->leaf_construct(SliceType(start, end, buffer))));
+                start = end;
+            }
+            return leaves;
+        }
+
+        NodeBase * _build_leaves(Vector && elements)
+        {
+            // Cuts `elements` into leaves of leaf_capacity
+            size_t n = elements.size();
+            size_t step = (leaf_capacity == 0 || n == 0) ? std::max<size_t>(n, 1) : leaf_capacity;
+            std::vector<size_t> ends;
+            for (size_t start = 0; start < n || ends.empty(); start += step)
+            {
+                ends.push_back(std::min(n, start + step));
+            }
+            auto leaves = _cut_leaves(std::move(elements), ends);
+            _reset_balance_state(leaves.size());
+            int height;
+            return _build_balanced(leaves.data(), leaves.size(), height);
+        }
+
+        NodeBase * _build_leaves(Vector && elements, const std::vector<uint64_t> & sizes)
+        {
+            // Leaves of the given sizes, in order
+            std::vector<size_t> ends;
+            ends.reserve(sizes.size());
+            size_t end = 0;
+            for (auto size : sizes)
+            {
+                end += static_cast<size_t>(size);
+                ends.push_back(end);
+            }
+            auto leaves = _cut_leaves(std::move(elements), ends);
+            _reset_balance_state(leaves.size());
+            int height;
+            return _build_balanced(leaves.data(), leaves.size(), height);
+        }
+
+        void _append_leaves(Vector && elements)
+        {
+            /*
+                Cuts `elements` into leaves of compact_leaf and hangs each one on the
+                right spine: one rebalance per leaf, none per element. The root may
+                be null, the first leaf then becomes it.
+             */
+            size_t n = elements.size();
+            std::vector<size_t> ends;
+            for (size_t start = 0; start < n; start += compact_leaf)
+            {
+                ends.push_back(std::min(n, start + compact_leaf));
+            }
+            for (auto leaf_base : _cut_leaves(std::move(elements), ends))
+            {
+                auto leaf = static_cast<LeafType*>(leaf_base);
+                if (this->root == nullptr)
+                {
+                    this->root = leaf;
+                    _reset_balance_state(1);
+                    continue;
+                }
+                auto last = _rightmost(this->root);
+                Node * p = _build_parent(last);
+                p->set_left(last);
+                p->set_right(leaf);
+                _renew(p);
+                _grown(p, static_cast<std::ptrdiff_t>(leaf->value.size()), static_cast<std::ptrdiff_t>(_weight(leaf)));
+            }
+        }
+
+        template<class Deleter>
+        BufferPtr _adopted_buffer(T * data, const size_t n, Deleter deleter)
+        {
+            // A buffer viewing `data`, which `deleter` gets back with the buffer, or at once on failure
+            std::shared_ptr<T> adopted(data, std::move(deleter), this->get_allocator());
+            BufferPtr buffer(_new_vector());
+            buffer->adopted = std::move(adopted);
+            buffer->adopted_size = n;
+            return buffer;
+        }
+
+        void _insert_leaf(const size_t index, LeafType * new_node)
+        {
+            /*
+                `new_node` goes in at `index` as a leaf of its own, never copied into
+                another one: the leaf there is split first if `index` falls inside it.
+             */
+            auto incoming = static_cast<std::ptrdiff_t>(new_node->value.size());
+            if (this->root == nullptr)
+            {
+                this->root = new_node;
+                _reset_balance_state(1);
+                return;
+            }
+            LeafType * leaf;
+            size_t local_index;
+            std::tie(leaf, local_index) = this->_access_node(this->root, index);
+            if (local_index != 0 && local_index != leaf->value.size())
+            {
+                leaf = std::get<1>(_split_leaf(leaf, local_index));
+                local_index = 0;
+            }
+            Node * p = _build_parent(leaf);
+            if (local_index == 0)
+            {
+                p->set_left(new_node);
+                p->set_right(leaf);
+            }
+            else
+            {
+                p->set_left(leaf);
+                p->set_right(new_node);
+            }
+            _renew(p);
+            _grown(p, incoming, static_cast<std::ptrdiff_t>(_weight(new_node)));
+        }
+
+        static void _collect(NodeBase * node, std::vector<NodeBase*> & leaves, std::vector<Node*> & inner)
+        {
+            // Leaves of the subtree in order, and its inner nodes
+            if (node->type == 'l')
+            {
+                leaves.push_back(node);
+            }
+            else
+            {
+                auto n = static_cast<Node*>(node);
+                _collect(n->left, leaves, inner);
+                _collect(n->right, leaves, inner);
+                inner.push_back(n);
+            }
+        }
+
+        void _rebuild(NodeBase * subtree)
+        {
+            // Replaces `subtree` by a perfectly balanced one over the same leaves
+            std::vector<NodeBase*> leaves;
+            std::vector<Node*> inner;
+            _collect(subtree, leaves, inner);
+            this->_counted(&dcounters::rebuilds);
+
+            auto parent = subtree->p;
+            bool left_side = parent != nullptr && parent->is_left_child(subtree);
+            for (auto n : inner)
+            {
+                this->node_destroy(static_cast<NodeType*>(n));
+            }
+
+            int height;
+            auto fresh = _build_balanced(leaves.data(), leaves.size(), height);
+            if (parent == nullptr)
+            {
+                this->root = fresh;
+                fresh->p = nullptr;
+            }
+            else if (left_side)
+            {
+                parent->set_left(fresh);
+            }
+            else
+            {
+                parent->set_right(fresh);
+            }
+        }
+
+        void _reset_balance_state(const size_t leaves)
+        {
+            if constexpr (!avl)
+            {
+                this->leaf_total = leaves;
+                this->leaf_max = leaves;
+            }
+        }
+
+        void _take_balance_state(const dvector_base & other)
+        {
+            static_cast<dbalance_state<avl>&>(*this) = other;
+        }
+
+        dmemory_usage _memory_usage() const
+        {
+            dmemory_usage usage;
+            std::unordered_set<const void*> buffers; // Leaves split from one another share theirs
+            _pre_order_traverse(this->root, [&](NodeBase * node, int) {
+                if (node->type == 'n')
+                {
+                    usage.node_bytes += sizeof(NodeType);
+                    usage.allocations += 1;
+                    return;
+                }
+                auto leaf = static_cast<LeafType*>(node);
+                usage.leaf_bytes += sizeof(LeafType);
+                usage.allocations += 1;
+                if (buffers.insert(leaf->value.get_buffer_id()).second)
+                {
+                    // Adopted memory counts as elements too, the dvector keeps it alive.
+                    // Paged out elements count as if in memory, and are not read back for it
+                    size_t live = leaf->value.get_live();
+                    size_t capacity = leaf->value.get_capacity();
+                    usage.element_bytes += live * sizeof(T);
+                    usage.dead_bytes += (capacity - live) * sizeof(T);
+                    usage.header_bytes += BufferPtr::header_bytes;
+                    usage.allocations += capacity > 0 ? 2 : 1;
+                }
+            });
+            return usage;
+        }
+
+        dstats _stats() const
+        {
+            dstats stats;
+            std::vector<size_t> sizes;
+            stats.height = _post_order_traverse<size_t>(this->root, [&](size_t lh, size_t rh, NodeBase * node) {
+                if (node->type == 'l')
+                {
+                    sizes.push_back(static_cast<LeafType*>(node)->value.size());
+                    return size_t(0);
+                }
+                stats.balance_factors[static_cast<int>(lh) - static_cast<int>(rh)] += 1;
+                return std::max(lh, rh) + 1;
+            });
+            stats.leaves = sizes.size();
+            stats.inner_nodes = stats.leaves > 0 ? stats.leaves - 1 : 0;
+            if (!sizes.empty())
+            {
+                std::sort(sizes.begin(), sizes.end());
+                auto percentile = [&](size_t p) { return sizes[(sizes.size() - 1) * p / 100]; };
+                size_t total = 0;
+                for (auto size : sizes)
+                {
+                    total += size;
+                }
+                stats.average_leaf_size = static_cast<double>(total) / sizes.size();
+                if constexpr (leaf_capacity != 0)
+                {
+                    stats.leaf_fill = stats.average_leaf_size / leaf_capacity;
+                }
+                stats.min_leaf_size = sizes.front();
+                stats.leaf_size_p50 = percentile(50);
+                stats.leaf_size_p90 = percentile(90);
+                stats.leaf_size_p99 = percentile(99);
+                stats.max_leaf_size = sizes.back();
+            }
+            stats.counters = this->_counters();
+            return stats;
+        }
+
+        static size_t _leaf_count(const NodeBase * node)
+        {
+            if (node->type == 'l')
+            {
+                return 1;
+            }
+            auto n = static_cast<const Node*>(node);
+            return _leaf_count(n->left) + _leaf_count(n->right);
+        }
+
+        void _grown(Node * p, const std::ptrdiff_t count_change, const std::ptrdiff_t weight_change)
+        {
+            // One more leaf below p, which is up to date
+            if constexpr (avl)
+            {
+                _fix_upward(p, count_change, weight_change, 1);
+            }
+            else
+            {
+                _fix_upward(p, count_change, weight_change, 0);
+                constexpr double alpha = Policy::balance::alpha;
+                this->leaf_total += 1;
+                this->leaf_max = std::max(this->leaf_max, this->leaf_total);
+
+                size_t depth = 1;
+                for (Node * n = p; n->p != nullptr; n = n->p)
+                {
+                    depth += 1;
+                }
+                if (depth <= std::log((double)this->leaf_total) / std::log(1 / alpha))
+                {
+                    return;
+                }
+
+                // Too deep: rebuild the lowest ancestor that has a child heavier than alpha
+                NodeBase * child = p;
+                size_t child_size = _leaf_count(p);
+                for (Node * n = p->p; n != nullptr; n = n->p)
+                {
+                    auto sibling = n->is_left_child(child) ? n->right : n->left;
+                    size_t size = child_size + _leaf_count(sibling);
+                    if (child_size > alpha * size)
+                    {
+                        _rebuild(n);
+                        return;
+                    }
+                    child = n;
+                    child_size = size;
+                }
+            }
+        }
+
+        void _shrunk(NodeBase * subtree, const std::ptrdiff_t count_change, const std::ptrdiff_t weight_change)
+        {
+            // One leaf less, `subtree` took the place of its parent
+            if constexpr (avl)
+            {
+                _fix_upward(subtree, count_change, weight_change, -1);
+            }
+            else
+            {
+                _fix_upward(subtree, count_change, weight_change, 0);
+                this->leaf_total -= 1;
+                if (this->leaf_total < Policy::balance::alpha * this->leaf_max)
+                {
+                    _rebuild(this->root);
+                    this->leaf_max = this->leaf_total;
+                }
+            }
+        }
+
+        static bool _can_append(LeafType * leaf, const size_t incoming)
+        {
+            return leaf->value.can_push_back() && 
+                (leaf_capacity == 0 || leaf->value.size() + incoming <= leaf_capacity);
+        }
+
+        NodeBase * left_rotate(Node * x)
         {
             /*
                    x                  y
@@ -85,36 +632,47 @@ namespace dv
                     / \            / \
                    b   c          a   b
              */
-            auto y = static_cast<dnode*>(x->right);
+            auto y = static_cast<Node*>(x->right);
             auto b = y->left;
+            this->_counted(&dcounters::left_rotations);
             _replace_node(y, x);
             x->set_right(b);
             y->set_left(x);
-            x->elem_count = x->left->count() + x->right->count();
-            y->elem_count = x->elem_count + y->right->count();
+            x->elem_count = _count(x->left) + _count(x->right);
+            y->elem_count = x->elem_count + _count(y->right);
+            if constexpr (weighted)
+            {
+                x->elem_weight = _weight(x->left) + _weight(x->right);
+                y->elem_weight = x->elem_weight + _weight(y->right);
+            }
             return y;
         }
 
-        dnode_base * _deep_copy(dnode_base * node)
+        NodeBase * _deep_copy(NodeBase * node)
         {
             if (node->type == 'l')
             {
-                return this->leaf_construct(*static_cast<LeafType*>(node));
+                // The copy is built with this container's allocator
+                auto leaf = static_cast<LeafType*>(node);
+                auto elements = _new_vector();
+                elements.assign(leaf->value.begin(), leaf->value.end());
+                return _weigh_leaf(this->leaf_construct(SliceType(0, elements.size(), std::move(elements))), 
+                    leaf->weight_sum);
             }
             else
             {
 
-                dnode * copy_node = this->node_construct();
-                copy_node->set_left(_deep_copy(static_cast<dnode*>(node)->left));
-                copy_node->set_right(_deep_copy(static_cast<dnode*>(node)->right));
-                copy_node->elem_count = static_cast<dnode*>(node)->elem_count;
-                copy_node->h = static_cast<dnode*>(node)->h;
+                // Copies h, counts and any extra payload of NodeType, children are replaced below
+                NodeType * copy_node = this->node_construct(*static_cast<NodeType*>(node));
+                copy_node->p = nullptr;
+                copy_node->set_left(_deep_copy(static_cast<Node*>(node)->left));
+                copy_node->set_right(_deep_copy(static_cast<Node*>(node)->right));
 
                 return copy_node;
             }
         }
 
-        dnode_base * right_rotate(dnode * y)
+        NodeBase * right_rotate(Node * y)
         {
             /*
                    x                  y
@@ -123,520 +681,1090 @@ namespace dv
                     / \            / \
                    b   c          a   b
              */
-            auto x = static_cast<dnode*>(y->left);
+            auto x = static_cast<Node*>(y->left);
             auto b = x->right;
+            this->_counted(&dcounters::right_rotations);
             _replace_node(x, y);
             x->set_right(y);
             y->set_left(b);
-            y->elem_count = y->left->count() + y->right->count();
-            x->elem_count = x->left->count() + y->elem_count;
+            y->elem_count = _count(y->left) + _count(y->right);
+            x->elem_count = _count(x->left) + y->elem_count;
+            if constexpr (weighted)
+            {
+                y->elem_weight = _weight(y->left) + _weight(y->right);
+                x->elem_weight = _weight(x->left) + y->elem_weight;
+            }
             return x;
         }
 
         static
         std::tuple<LeafType*, size_t>
-        _access_node(const dnode_base * node, const size_t index)
+        _access_node(const NodeBase * node, const size_t index)
         {
             // std::cout << "node->count() == " << node->count() << std::endl;
-            assert(index <= node->count()); // tail + 1 also legal here
+            // `index` is not checked against the count of `node`: on a dvector's right spine it may lag behind
             auto local_index = index;
             while (node->type != 'l')
             {
-                auto n = (dnode *)node;
-                if (local_index < n->left->count())
+                auto n = (Node *)node;
+                if (local_index < _count(n->left))
                 {
                     node = n->left;
                 }
                 else 
                 {
-                    local_index = local_index - n->left->count();
+                    local_index = local_index - _count(n->left);
                     node = n->right;
                 }
             }
-            return std::make_tuple((LeafType*)node, local_index);
-        }
-
-        void _group_empty(LeafType * node)
-        {
-            dnode_base * brother;
-            if (node->count() == 0 && node->p)
+            return std::make_tuple((LeafType*)node, local_index);
+        }
+
+        static
+        std::tuple<size_t, size_t>
+        _access_weight(const NodeBase * node, const size_t offset)
+        {
+            /*
+                Descends by cumulative weight instead of count.
+                Returns the index of the element that covers `offset`,
+                and the offset inside that element.
+             */
+            auto local_offset = offset; // Unchecked, like the index of _access_node
+            size_t index = 0;
+            while (node->type != 'l')
+            {
+                auto n = (Node *)node;
+                if (local_offset < _weight(n->left))
+                {
+                    node = n->left;
+                }
+                else
+                {
+                    local_offset = local_offset - _weight(n->left);
+                    index = index + _count(n->left);
+                    node = n->right;
+                }
+            }
+            auto leaf = (LeafType*)node;
+            size_t local_index = 0;
+            for (; local_index < leaf->value.size(); local_index++)
+            {
+                auto w = _weigh(leaf->value[local_index]);
+                if (local_offset < w)
+                {
+                    break;
+                }
+                local_offset = local_offset - w;
+            }
+            return std::make_tuple(index + local_index, local_offset);
+        }
+
+        static
+        size_t _weight_before(const NodeBase * node, const size_t index)
+        {
+            // Total weight of the elements before `index`, unchecked like that of _access_node
+            auto local_index = index;
+            size_t before = 0;
+            while (node->type != 'l')
+            {
+                auto n = (Node *)node;
+                if (local_index < _count(n->left))
+                {
+                    node = n->left;
+                }
+                else
+                {
+                    local_index = local_index - _count(n->left);
+                    before = before + _weight(n->left);
+                    node = n->right;
+                }
+            }
+            return before + _weigh_prefix((LeafType*)node, local_index);
+        }
+
+        void _replace(NodeBase * root_node, const size_t index, T && element)
+        {
+            LeafType * leaf;
+            size_t local_index;
+            std::tie(leaf, local_index) = this->_access_node(root_node, index);
+
+            std::ptrdiff_t weight_change = 0;
+            if constexpr (weighted)
+            {
+                weight_change = static_cast<std::ptrdiff_t>(_weigh(element)) - 
+                    static_cast<std::ptrdiff_t>(_weigh(leaf->value[local_index]));
+                leaf->weight_sum = static_cast<Count>(leaf->weight_sum + weight_change);
+            }
+            leaf->value[local_index] = std::move(element);
+            if constexpr (weighted)
+            {
+                _fix_upward(leaf, 0, weight_change, 0);
+            }
+        }
+
+        template<class Modifier>
+        void _modify(NodeBase * root_node, const size_t index, Modifier & modifier)
+        {
+            // modifier(element) in place, then the element is weighed again, even if it threw
+            LeafType * leaf;
+            size_t local_index;
+            std::tie(leaf, local_index) = this->_access_node(root_node, index);
+            T & element = leaf->value[local_index];
+            if constexpr (weighted)
+            {
+                std::ptrdiff_t before = _weigh(element);
+                auto reweigh = [&]() {
+                    std::ptrdiff_t weight_change = static_cast<std::ptrdiff_t>(_weigh(element)) - before;
+                    leaf->weight_sum = static_cast<Count>(leaf->weight_sum + weight_change);
+                    _fix_upward(leaf, 0, weight_change, 0);
+                };
+                try
+                {
+                    modifier(element);
+                }
+                catch (...)
+                {
+                    reweigh();
+                    throw;
+                }
+                reweigh();
+            }
+            else
+            {
+                modifier(element);
+            }
+        }
+
+        void _remove_leaf(LeafType * node, const std::ptrdiff_t count_change, const std::ptrdiff_t weight_change)
+        {
+            /*
+                Takes `node` (with a parent) out of the tree, its brother takes the 
+                place of the parent. The changes are those of the whole subtree 
+                of the parent, i.e. what `node` held before the erasure.
+             */
+            NodeBase * brother = node->get_brother();
+            if (brother == nullptr)
+            {
+                std::cout << this->visualize(node, false) << std::endl;
+                std::cout << this->visualize(node->p, false) << std::endl;
+                throw std::exception();
+            }
+            _replace_node(brother, node->p);
+            this->node_destroy(static_cast<NodeType*>(node->p));
+            this->leaf_destroy(node);
+            _shrunk(brother, count_change, weight_change);
+        }
+
+        template<class Make>
+        static LeafType * _made(const bool best_effort, const Make & make)
+        {
+            // make(), or nullptr if it throws and `best_effort` is set
+            if (best_effort)
+            {
+                try
+                {
+                    return make();
+                }
+                catch (...)
+                {
+                    return nullptr;
+                }
+            }
+            return make();
+        }
+
+        LeafType * _repack(LeafType * leaf, const bool best_effort = false)
+        {
+            // A copy of the slice in a vector of its own takes the place of `leaf`, no count changes
+            auto packed = _made(best_effort, [&]() { 
+                return _weigh_leaf(this->leaf_construct(leaf->value), leaf->weight_sum); 
+            });
+            if (packed == nullptr)
+            {
+                return leaf;
+            }
+            this->_counted(&dcounters::repacks);
+            _replace_node(packed, leaf);
+            this->leaf_destroy(leaf);
+            return packed;
+        }
+
+        LeafType * _repack_sparse(LeafType * leaf, const bool best_effort = false)
+        {
+            /*
+                Once most of a shared vector is erased, each slice still in it moves
+                out when it is next touched and the last one to go frees the vector.
+                The elements copied are fewer than those erased before, so it is 
+                amortized O(1) per erasure. A short leaf takes its brother along
+                if that is a short leaf too, erasures leave many of them behind.
+                The copy is made before the tree is touched. With `best_effort`, 
+                a copy that throws is given up and `leaf` stays in the sparse vector.
+             */
+            if (!leaf->value.sparse(repack_ratio))
+            {
+                return leaf;
+            }
+            auto brother = leaf->get_brother();
+            if (brother == nullptr || brother->type != 'l' || 
+                leaf->value.size() + static_cast<LeafType*>(brother)->value.size() > shift_limit)
+            {
+                return _repack(leaf, best_effort);
+            }
+            Node * p = leaf->p;
+            auto left = static_cast<LeafType*>(p->left);
+            auto right = static_cast<LeafType*>(p->right);
+            auto merged = _made(best_effort, [&]() {
+                Vector v = _new_vector();
+                v.reserve(left->value.size() + right->value.size());
+                v.insert(v.end(), left->value.begin(), left->value.end());
+                v.insert(v.end(), right->value.begin(), right->value.end());
+                return _weigh_leaf(this->leaf_construct(SliceType(0, v.size(), std::move(v))), 
+                    left->weight_sum + right->weight_sum);
+            });
+            if (merged == nullptr)
+            {
+                return leaf;
+            }
+            _replace_node(merged, p);
+            this->_counted(&dcounters::leaf_merges);
+            this->node_destroy(static_cast<NodeType*>(p));
+            this->leaf_destroy(left);
+            this->leaf_destroy(right);
+            _shrunk(merged, 0, 0);
+            return merged;
+        }
+
+        void _repack_all()
+        {
+            // Repacks every leaf in a sparse vector, from left to right
+            size_t total = _count(this->root);
+            size_t index = 0;
+            while (index < total)
+            {
+                LeafType * leaf;
+                size_t local_index;
+                std::tie(leaf, local_index) = this->_access_node(this->root, index);
+                if (leaf->value.sparse(repack_ratio))
+                {
+                    _repack_sparse(leaf);
+                    std::tie(leaf, local_index) = this->_access_node(this->root, index);
+                }
+                index = index - local_index + leaf->value.size();
+            }
+        }
+
+        void _compact()
+        {
+            /*
+                Moves every element, in order, into fresh vectors of compact_leaf
+                elements and puts a perfectly balanced tree over them. The old nodes
+                are only freed once the new tree is built. If anything throws before,
+                the elements are moved back and the tree is left as it was. Elements
+                whose moves may throw are copied instead, like std::vector does.
+             */
+            size_t total = _count(this->root);
+            if (total == 0)
+            {
+                return;
+            }
+            std::vector<NodeBase*> leaves;
+            std::vector<Node*> inner;
+            _collect(this->root, leaves, inner);
+
+            std::vector<SliceType> parts; // Filled vectors, in order. They keep viewing them after the leaves take them
+            std::vector<NodeBase*> packed;
+            Vector v = _new_vector();
+            size_t done = 0;
+            NodeBase * fresh = nullptr;
+            try
+            {
+                parts.reserve((total + compact_leaf - 1) / compact_leaf);
+                packed.reserve(parts.capacity());
+                for (auto node : leaves)
+                {
+                    for (auto & e : static_cast<LeafType*>(node)->value)
+                    {
+                        if (v.empty())
+                        {
+                            v.reserve(std::min(total - done, compact_leaf));
+                        }
+                        if constexpr (compact_moves)
+                        {
+                            v.push_back(std::move(e));
+                        }
+                        else
+                        {
+                            v.push_back(e);
+                        }
+                        if (v.size() == compact_leaf || done + v.size() == total)
+                        {
+                            size_t n = v.size();
+                            parts.emplace_back(0, n, std::move(v)); // Takes `v` only once nothing else can throw
+                            done += n;
+                            v = _new_vector();
+                        }
+                    }
+                }
+                for (auto & part : parts)
+                {
+                    packed.push_back(_weigh_leaf(this->leaf_construct(std::move(part))));
+                }
+                int height;
+                fresh = _build_balanced(packed.data(), packed.size(), height);
+            }
+            catch (...)
+            {
+                if constexpr (compact_moves)
+                {
+                    // The first `done` elements are in `parts`, the next ones in `v`
+                    size_t part = 0, at = 0, back = 0;
+                    for (auto node : leaves)
+                    {
+                        for (auto & e : static_cast<LeafType*>(node)->value)
+                        {
+                            if (back == done + v.size())
+                            {
+                                break;
+                            }
+                            if (back < done)
+                            {
+                                e = std::move(parts[part][at]);
+                                if (++at == parts[part].size())
+                                {
+                                    part += 1;
+                                    at = 0;
+                                }
+                            }
+                            else
+                            {
+                                e = std::move(v[back - done]);
+                            }
+                            back += 1;
+                        }
+                    }
+                }
+                for (auto leaf : packed)
+                {
+                    this->leaf_destroy(static_cast<LeafType*>(leaf));
+                }
+                throw;
+            }
+
+            for (auto n : inner)
+            {
+                this->node_destroy(static_cast<NodeType*>(n));
+            }
+            for (auto leaf : leaves)
+            {
+                this->leaf_destroy(static_cast<LeafType*>(leaf));
+            }
+            _reset_balance_state(packed.size());
+            this->root = fresh;
+            this->root->p = nullptr;
+        }
+
+        size_t _compact_step(const size_t index)
+        {
+            /*
+                Packs the run of leaves starting with the one holding `index` into a
+                vector of at most compact_leaf elements of its own. The first leaf
+                takes the place of the run, the others are removed like erased leaves,
+                so the tree is valid and balanced after every step. Returns the index
+                of the first element after the run.
+             */
+            LeafType * first;
+            size_t local_index;
+            std::tie(first, local_index) = this->_access_node(this->root, index);
+            size_t start = index - local_index;
+            size_t total = _count(this->root);
+
+            std::vector<LeafType*> run{ first };
+            size_t count = first->value.size();
+            while (start + count < total)
+            {
+                LeafType * next = std::get<0>(this->_access_node(this->root, start + count));
+                if (count + next->value.size() > compact_leaf)
+                {
+                    break;
+                }
+                run.push_back(next);
+                count += next->value.size();
+            }
+            if (run.size() == 1 && (first->value.packed() || 
+                (count >= compact_leaf && !first->value.sparse(repack_ratio))))
+            {
+                // Nothing to join it with, and its vector is not mostly dead
+                return start + count;
+            }
+
+            std::ptrdiff_t first_count = first->value.size();
+            std::ptrdiff_t first_weight = first->weight_sum;
+            /*
+                The new leaf and its vector are allocated before any element leaves
+                the run, which is then filled like _compact does. If an element
+                throws, the ones moved go back and the run is left as it was.
+             */
+            Vector v = _new_vector();
+            v.reserve(count);
+            auto fresh = this->leaf_construct(SliceType(0, 0, std::move(v)));
+            Count weight = 0;
+            try
+            {
+                for (auto leaf : run)
+                {
+                    for (auto & e : leaf->value)
+                    {
+                        if constexpr (compact_moves)
+                        {
+                            fresh->value.emplace_back(std::move(e));
+                        }
+                        else
+                        {
+                            fresh->value.emplace_back(e);
+                        }
+                    }
+                    weight = static_cast<Count>(weight + leaf->weight_sum);
+                }
+            }
+            catch (...)
             {
-                brother = node->get_brother();
-                if (brother == nullptr)
+                if constexpr (compact_moves)
                 {
-                    std::cout << this->visualize(node, false) << std::endl;
-                    std::cout << this->visualize(node->p, false) << std::endl;
-                    throw std::exception();
+                    size_t back = 0;
+                    for (auto leaf : run)
+                    {
+                        for (auto & e : leaf->value)
+                        {
+                            if (back == fresh->value.size())
+                            {
+                                break;
+                            }
+                            e = std::move(fresh->value[back++]);
+                        }
+                    }
                 }
-                //std::cout << "visualizing group_empty" << std::endl;
-                //std::cout << this->visualize(node->p->p, false) << std::endl;
-                //std::cout << "===========================" << std::endl;
-                _replace_node(brother, node->p);
-                //std::cout << this->visualize(brother->p->p, false) << std::endl;
-                //std::cout << "===========================" << std::endl;
-                this->destroy(node->p);
-                this->destroy(node);
-                if (brother->p != nullptr)
-                    brother->p->renew_count();
-                _rebalance(brother, -1);
+                this->leaf_destroy(fresh);
+                throw;
+            }
+            _weigh_leaf(fresh, weight);
+            _replace_node(fresh, first);
+            this->leaf_destroy(first);
+            _add_upward(fresh, static_cast<std::ptrdiff_t>(count) - first_count, 
+                static_cast<std::ptrdiff_t>(weight) - first_weight);
+            for (size_t i = 1; i < run.size(); i++)
+            {
+                _remove_leaf(run[i], -static_cast<std::ptrdiff_t>(run[i]->value.size()), 
+                    -static_cast<std::ptrdiff_t>(run[i]->weight_sum));
             }
+            return start + count;
         }
 
-        void _erase(dnode_base * root_node, const size_t index) noexcept
+        void _erase(NodeBase * root_node, const size_t index)
         {
             /*
-                  
-            
-            
+                Erasing inside a leaf splits it, which allocates and may throw before
+                anything changed. Repacking what became sparse is only best effort: 
+                once the element is gone, the erasure does not fail for it.
              */
-            
             LeafType * leaf;
             size_t local_index;
 
             std::tie(leaf, local_index) = this->_access_node(root_node, index);
-            size_t local_len = leaf->count();
+            size_t local_len = leaf->value.size();
 
-            if (local_index == 0)
+            std::ptrdiff_t erased_weight = _weigh(leaf->value[local_index]);
+
+            if (local_len == 1 && leaf->p != nullptr)
             {
-                auto old_slice_right = this->leaf_construct(leaf->value.slice(1, local_len));
-                _replace_node(old_slice_right, leaf);
-                if (old_slice_right->p != nullptr)
-                    old_slice_right->p->renew_count();
-                _group_empty(old_slice_right);
-                //std::cout << "destroy leaf!" << std::endl;
-                this->destroy(leaf);
+                _remove_leaf(leaf, -1, -erased_weight);
             }
-            else if (local_index == local_len - 1)
+            else if (local_index == 0 || local_index == local_len - 1)
             {
-                auto old_slice_left = this->leaf_construct(leaf->value.slice(0, local_len - 1));
-                _replace_node(old_slice_left, leaf);
-                if (old_slice_left->p != nullptr)
-                    old_slice_left->p->renew_count();
-                _group_empty(old_slice_left);
-                //std::cout << "destroy leaf!" << std::endl;
-                this->destroy(leaf);
+                // Shrink the slice in place, no new leaf is needed at the ends
+                if (local_index == 0)
+                {
+                    leaf->value.pop_front();
+                }
+                else
+                {
+                    leaf->value.pop_back();
+                }
+                _weigh_leaf(leaf, leaf->weight_sum - erased_weight);
+                _fix_upward(leaf, -1, -erased_weight, 0);
+                _repack_sparse(leaf, true);
             }
             else
             {
-                dnode * p = _build_parent(leaf);
                 auto old_slice_left = this->leaf_construct(leaf->value.slice(0, local_index));
-                auto old_slice_right = this->leaf_construct(leaf->value.slice(local_index + 1, local_len));
+                LeafType * old_slice_right = nullptr;
+                Node * p;
+                try
+                {
+                    old_slice_right = this->leaf_construct(leaf->value.slice(local_index + 1, local_len));
+                    p = _build_parent(leaf);
+                }
+                catch (...)
+                {
+                    // The tree is not touched yet
+                    this->leaf_destroy(old_slice_left);
+                    if (old_slice_right != nullptr)
+                    {
+                        this->leaf_destroy(old_slice_right);
+                    }
+                    throw;
+                }
+                this->_counted(&dcounters::leaf_splits);
+                auto left_weight = _weigh_prefix(leaf, local_index);
+                _weigh_leaf(old_slice_left, left_weight);
+                _weigh_leaf(old_slice_right, leaf->weight_sum - left_weight - erased_weight);
                 p->set_left(old_slice_left);
                 p->set_right(old_slice_right);
-                p->renew_count();
-                _rebalance(p, 1);
-                this->destroy(leaf); // Old leaf no longer there
+                _renew(p);
+                leaf->value.discard(local_index);
+                this->leaf_destroy(leaf); // Old leaf no longer there
+                _grown(p, -1, -erased_weight);
+
+                // Both halves are in the same vector, the left one may take the right one along
+                bool paired = old_slice_left->get_brother() == old_slice_right;
+                size_t left_len = old_slice_left->value.size();
+                auto kept = _repack_sparse(old_slice_left, true);
+                if (!paired || kept->value.size() == left_len)
+                {
+                    _repack_sparse(old_slice_right, true);
+                }
             }
         }
 
-        void _insert_node(dnode_base * root_node, const size_t index, const Vector & elements)
+        void _insert_node(NodeBase * root_node, const size_t index, const Vector & elements)
         {
             auto new_node_builder = [&](LeafType* leaf)
             {
                 if (leaf == nullptr)
                 {
-                    return this->leaf_construct(SliceType(0, elements.size(), elements));
+                    return _weigh_leaf(this->leaf_construct(SliceType(0, elements.size(), elements)));
                 }
                 else
                 {
                     for (const auto & e : elements)
                     {
+                        _weigh_leaf(leaf, leaf->weight_sum + _weigh(e));
                         leaf->value.push_back(e);
                     }
                     return leaf;
                 }
             };
-            _insert_node(root_node, index, new_node_builder);
+            _insert_node(root_node, index, elements.size(), new_node_builder);
         }
 
-        void _insert_node(dnode_base * root_node, const size_t index, Vector && elements)
+        void _insert_node(NodeBase * root_node, const size_t index, Vector && elements)
         {
             auto new_node_builder = [&](LeafType* leaf)
             {
                 if (leaf == nullptr)
                 {
-                    return this->leaf_construct(SliceType(0, elements.size(), std::move(elements)));
+                    return _weigh_leaf(this->leaf_construct(SliceType(0, elements.size(), std::move(elements))));
                 }
                 else
                 {
                     for (auto & e : elements)
                     {
+                        _weigh_leaf(leaf, leaf->weight_sum + _weigh(e));
                         leaf->value.push_back(std::move(e));
                     }
                     return leaf;
                 }
             };
-            _insert_node(root_node, index, new_node_builder);
+            _insert_node(root_node, index, elements.size(), new_node_builder);
         }
 
-        void _insert_node(dnode_base * root_node, const size_t index, const T & element)
+        void _insert_node(NodeBase * root_node, const size_t index, const T & element)
         {
-            auto new_node_builder = [&](LeafType* leaf)
-            {
-                if (leaf == nullptr)
-                {
-                    return this->leaf_construct(SliceType(0, 1, Vector { element }));
-                }
-                else
-                {
-                    leaf->value.push_back(element);
-                    return leaf;
-                }
-            };
-            _insert_node(root_node, index, new_node_builder);
+            _emplace_node(root_node, index, element);
         }
 
-        void _insert_node(dnode_base * root_node, const size_t index, T && element)
+        void _insert_node(NodeBase * root_node, const size_t index, T && element)
         {
-            auto new_node_builder = [&](LeafType* leaf)
+            _emplace_node(root_node, index, std::move(element));
+        }
+
+        std::tuple<LeafType *, LeafType *> _split_leaf(LeafType * leaf, const size_t at)
+        {
+            // Two slices of the same vector take the place of `leaf`, no count changes
+            size_t local_len = leaf->value.size();
+            Node * p = _build_parent(leaf);
+            auto left = this->leaf_construct(leaf->value.slice(0, at));
+            auto right = this->leaf_construct(leaf->value.slice(at, local_len));
+            this->_counted(&dcounters::leaf_splits);
+            auto left_weight = _weigh_prefix(leaf, at);
+            _weigh_leaf(left, left_weight);
+            _weigh_leaf(right, leaf->weight_sum - left_weight);
+            p->set_left(left);
+            p->set_right(right);
+            _renew(p);
+            this->leaf_destroy(leaf); // Old leaf no longer there
+            _grown(p, 0, 0);
+            return { left, right };
+        }
+
+        template<class... Args>
+        void _own_leaf(LeafType * leaf, const size_t local_index, Args&&... args)
+        {
+            /*
+                Replaces `leaf` by a copy in a vector of its own, with the new element
+                at `local_index` and spare capacity, so the next inserts there happen
+                in place.
+             */
+            size_t local_len = leaf->value.size();
+            Vector v = _new_vector();
+            v.reserve(std::max(local_len + 1, std::min(shift_limit, 2 * (local_len + 1))));
+            v.insert(v.end(), leaf->value.begin(), leaf->value.end());
+            v.emplace(v.begin() + local_index, std::forward<Args>(args)...);
+            auto weight = _weigh(v[local_index]);
+            auto owned = _weigh_leaf(this->leaf_construct(SliceType(0, v.size(), std::move(v))), 
+                leaf->weight_sum + weight);
+            _replace_node(owned, leaf);
+            this->leaf_destroy(leaf);
+            _fix_upward(owned, 1, static_cast<std::ptrdiff_t>(weight), 0);
+        }
+
+        template<class... Args>
+        void _emplace_node(NodeBase * root_node, const size_t index, Args&&... args)
+        {
+            /*
+                Constructs one element in place in the leaf at `index` if it has room:
+                spare capacity at its end, unused room in front, or a short vector of
+                its own to shift. A short leaf without one is copied into its own
+                vector first, a full one is split and its shorter part copied. Only at the ends
+                of a full leaf, or in the middle of a long one, a new leaf is built.
+             */
+            LeafType * leaf;
+            size_t local_index;
+
+            std::tie(leaf, local_index) = this->_access_node(root_node, index);
+            size_t local_len = leaf->value.size();
+            bool room = leaf_capacity == 0 || local_len < leaf_capacity;
+
+            if (room && local_index == local_len && leaf->value.can_push_back())
             {
-                if (leaf == nullptr)
+                leaf->value.emplace_back(std::forward<Args>(args)...);
+            }
+            else if (room && local_index == 0 && leaf->value.can_push_front())
+            {
+                leaf->value.emplace_front(std::forward<Args>(args)...);
+            }
+            else if (room && local_len < shift_limit && leaf->value.can_insert())
+            {
+                leaf->value.emplace(local_index, std::forward<Args>(args)...);
+            }
+            else if (local_index > 0 && local_index < local_len && local_len <= 2 * shift_limit)
+            {
+                if (!room || local_len >= shift_limit)
                 {
-                    return this->leaf_construct(SliceType(0, 1, Vector { element }));
+                    // Split at the new element, which keeps the first elements of subtrees apart from it
+                    LeafType * left, * right;
+                    std::tie(left, right) = _split_leaf(leaf, local_index);
+                    if (local_index <= local_len - local_index)
+                    {
+                        leaf = left;
+                    }
+                    else
+                    {
+                        leaf = right;
+                        local_index = 0;
+                    }
                 }
-                else
+                _own_leaf(leaf, local_index, std::forward<Args>(args)...);
+                return;
+            }
+            else
+            {
+                auto new_node_builder = [&](LeafType* leaf)
                 {
-                    leaf->value.push_back(std::move(element));
-                    return leaf;
-                }
-            };
-            _insert_node(root_node, index, new_node_builder);
+                    if (leaf == nullptr)
+                    {
+                        Vector v = _new_vector();
+                        v.emplace_back(std::forward<Args>(args)...);
+                        return _weigh_leaf(this->leaf_construct(SliceType(0, 1, std::move(v))));
+                    }
+                    else
+                    {
+                        leaf->value.emplace_back(std::forward<Args>(args)...);
+                        _weigh_leaf(leaf, leaf->weight_sum + _weigh(leaf->value[leaf->value.size() - 1]));
+                        return leaf;
+                    }
+                };
+                _insert_node(root_node, index, 1, new_node_builder);
+                return;
+            }
+            auto weight = _weigh(leaf->value[local_index]);
+            _weigh_leaf(leaf, leaf->weight_sum + weight);
+            _fix_upward(leaf, 1, static_cast<std::ptrdiff_t>(weight), 0);
         }
 
-        void _insert_node(dnode_base * root_node, const size_t index, 
-            const std::function<LeafType*(LeafType*)> & new_node_builder, 
-            LeafType * force_new_leaf = nullptr)
+        template<class Builder>
+        void _insert_node(NodeBase * root_node, const size_t index, const size_t incoming,
+            const Builder & new_node_builder)
         {
+            /*
+                `new_node_builder(nullptr)` builds a leaf of the incoming elements,
+                `new_node_builder(leaf)` appends them to `leaf` instead.
+             */
             LeafType * leaf;
             size_t local_index;
 
             std::tie(leaf, local_index) = this->_access_node(root_node, index); 
             // Find insertion place
 
-            size_t local_len = leaf->count();
+            size_t local_len = leaf->value.size();
 
-            //std::cout << "local_len = " << local_len << std::endl;
-
-            if (local_index == local_len)
+            if (local_index == local_len && _can_append(leaf, incoming))
+            {
+                auto weight_before = leaf->weight_sum;
+                new_node_builder(leaf);
+                _fix_upward(leaf, incoming, 
+                    static_cast<std::ptrdiff_t>(leaf->weight_sum) - static_cast<std::ptrdiff_t>(weight_before), 0);
+            }
+            else if (local_index == local_len || local_index == 0)
             {
-                if (!leaf->value.can_push_back() || force_new_leaf)
+                LeafType* new_node = new_node_builder(nullptr);
+                Node * p = _build_parent(leaf);
+                if (local_index == 0)
                 {
-                    LeafType* new_node = force_new_leaf ? force_new_leaf : new_node_builder(nullptr);
-                    dnode * p = _build_parent(leaf);
-                    p->set_left(leaf);
-                    p->set_right(new_node);
-                    p->renew_count();
-                    _rebalance(p, 1);
+                    p->set_left(new_node);
+                    p->set_right(leaf);
                 }
                 else
                 {
-                    leaf = new_node_builder(leaf);
-                    if (leaf->p != nullptr)
-                        leaf->p->renew_count();
+                    p->set_left(leaf);
+                    p->set_right(new_node);
                 }
-            }
-            else if (local_index == 0)
-            {
-                LeafType* new_node = new_node_builder(nullptr);
-                dnode * p = _build_parent(leaf);
-                p->set_left(new_node);
-                p->set_right(leaf);
-                p->renew_count();
-                _rebalance(p, 1);
+                _renew(p);
+                _grown(p, incoming, new_node->weight_sum);
             }
             else
             {
+                /*
+                    Splits the leaf first, which changes no count, then puts the
+                    new leaf in front of the right half. Only the second walk has
+                    to go all the way up.
+                 */
+                LeafType * old_slice_right = std::get<1>(_split_leaf(leaf, local_index));
+
                 LeafType* new_node = new_node_builder(nullptr);
-                dnode * p = _build_parent(leaf);
-                auto old_slice_left = this->leaf_construct(leaf->value.slice(0, local_index));
-                auto old_slice_right = this->leaf_construct(leaf->value.slice(local_index, local_len));
-                p->set_left(old_slice_left);
-                p->set_right(new_node);
-                _rebalance(p, 1);
-                // std::cout << "inserting again" << std::endl;
-                _insert_node(new_node, new_node->count(), [](auto) { return nullptr; }, old_slice_right); // Insert next to new_node
-                this->destroy(leaf); // Old leaf no longer there
+                Node * q = _build_parent(old_slice_right);
+                q->set_left(new_node);
+                q->set_right(old_slice_right);
+                _renew(q);
+                _grown(q, incoming, new_node->weight_sum);
             }
         }
 
-        void _rebalance(dnode_base * subtree, int height_change)
+        NodeBase * _rebalance_step(NodeBase * subtree, int & height_change)
         {
-            dnode * current = static_cast<dnode*>(subtree);
-            char current_place = '\0';
+            /*
+                Applies the height change of `subtree` to the balance factor of its
+                parent, rotating there if needed. Returns the node that now stands
+                in the parent's place, or the parent itself. `height_change` is set
+                to 0 once the subtree above no longer changes its height.
+             */
+            Node * parent = subtree->p;
+            if (subtree->type == 'n')
+                DV_CHECKH(static_cast<Node*>(subtree))
+
+            int original_weight = parent->h;
+            parent->renew_height(parent->is_left_child(subtree) ? 'l' : 'r', height_change);
 
-            // std::cout << "_rebalance loop starts" << std::endl;
-            while (current != nullptr && current->p != nullptr)
+            bool keep_height = 
+                ((parent->h == 0) && (height_change == 1)) ||
+                ((original_weight == 0) && (height_change == -1));
+
+            if (keep_height) // Can no longer affect more heights
             {
-                if (current->type == 'n')
-                    DV_CHECKH(current)
+                height_change = 0;
+                return parent;
+            }
 
-                if (current->p->is_left_child(current))
-                {
-                    current_place = 'l';
-                }
-                else
+            if (parent->h == -2) 
+            {
+                Node * current = static_cast<Node*>(parent->right);
+                /* Right-Right
+                       y                          x
+                      / \                       /   \
+                     h   x             ->      y    h+1
+                        / \                   / \
+                  (h,h+1)  (h+1)             h  (h, h+1)
+
+                  original y_height = h + 2 --> current x_height = h + 2
+                 */
+                Node * x = current;
+                int x_h = current->h;
+                Node * y = parent;
+                if (current->h > 0)
                 {
-                    current_place = 'r';
-                }
+                    /* Right-Left
+                             y                                               y
+                            / \                                             / \
+                           h   x'                                          h   x
+                              / \                                ->           / \
+                             x  h-1                                          a   x'
+                            / \                                                 / \
+                          h-1 h-1    or   h-1  h-2   or   h-2   h-1           b   h-1
+
+                          b - (h-1) = 0 -> 0; 1 -> -1; -1 -> 0;
+                          x_h = a - (max(b, h-1) + 1) = a - h 
+                          a - h = {0, 1} -> -1; -1 -> -2;
+                     */
+                    Node * x_ = static_cast<Node*>(y->right);
+                    x = static_cast<Node*>(x_->left);
+
+                    if (x->h <= 0)
+                    {
+                        x_->h = 0;
+                    } 
+                    else
+                    {
+                        x_->h = -1;
+                    }
 
-                int original_weight = current->p->h;
+                    if (x->h >= 0)
+                    {
+                        x_h = -1;
+                    }
+                    else
+                    {
+                        x_h = -2;
+                    }
 
-                //auto before = this->visualize(current->p, false);
+                    right_rotate(x_);
+                    DV_CHECKH(x);
+                }
 
-                //std::cout << "current_place: " << current_place << std::endl;
-                //std::cout << current->p->id << ": " << (int)current->p->h;
-                current->p->renew_height(current_place, height_change);
-                //std::cout << " -> " << (int)current->p->h << std::endl;
-                //auto after = this->visualize(current->p, false);
+                y->h = -1 - x_h;
+                if (x_h <= -1) x->h = 0;
+                else x->h = 1;
 
-                bool keep_height = 
-                    ((current->p->h == 0) && (height_change == 1)) ||
-                    ((original_weight == 0) && (height_change == -1));
-                                   
+                auto top = left_rotate(y);
+                // x_h = 0 -> x : (h+1, h+1) -> y : (h, h+1) -> y_h = -1; 
+                // x_h = -1 -> x : (h, h+1) -> y : (h, h) -> y_h = 0; 
 
-                if (keep_height) // Can no longer affect more heights
+                if (height_change > 0 || x_h == 0)
                 {
-                    //std::cout << "stop rebalancing at " << current->p->id << std::endl;
-                    break;
+                    height_change = 0;
                 }
-
-                // std::cout << "1. current->p->h == " << (int)current->p->h << std::endl;
-                // std::cout << visualize(this->root, false);
-
-                if (current->p->h == -2) 
+                return top;
+            }
+            else if (parent->h == 2)
+            {
+                Node * current = static_cast<Node*>(parent->left);
+                /* Left-Left
+                               y                   x
+                              / \                 / \
+                             x   h         ->  h+1   y
+                            / \                     / \
+                      (h+1)  (h,h+1)          (h, h+1) h
+                */
+
+                Node * x = current;
+                int x_h = current->h;
+                Node * y = parent;
+
+                if (current->h < 0)
                 {
-                    current = (dnode*)current->p->right;
-                    /* Right-Right
-                           y                          x
-                          / \                       /   \
-                         h   x             ->      y    h+1
-                            / \                   / \
-                      (h,h+1)  (h+1)             h  (h, h+1)
+                    /* Left-Right
+                         y                                               y
+                        / \                                             / \
+                       x'                                              x   h
+                      / \                                             / \
+                    h-1  x                                           x'  a
+                        / \                                         / \       
+                      h-1 h-1    or    h-1  h-2   or   h-2   h-1  h-1  b   
+                       b   a
+                          0               1                 -1
+                          0                0                1
+                      (h-1) - b = -1 -> 0; 1 -> 1; 0 -> 0;
+                      x_h = (max(b, h-1) + 1) - a = h - a
+                      h - a = (0, -1) -> 1; 1 -> 2;
+                    */
+                    Node * x_ = static_cast<Node*>(y->left);
+                    x = static_cast<Node*>(x_->right);
 
-                      original y_height = h + 2 --> current x_height = h + 2
-                     */
-                    dnode * x = current;
-                    int x_h = current->h;
-                    dnode * y = current->p;
-                    if (current->h > 0)
+                    if (x->h >= 0)
                     {
-                        /* Right-Left
-                                 y                                               y
-                                / \                                             / \
-                               h   x'                                          h   x
-                                  / \                                ->           / \
-                                 x  h-1                                          a   x'
-                                / \                                                 / \
-                              h-1 h-1    or   h-1  h-2   or   h-2   h-1           b   h-1
-
-                              b - (h-1) = 0 -> 0; 1 -> -1; -1 -> 0;
-                              x_h = a - (max(b, h-1) + 1) = a - h 
-                              a - h = {0, 1} -> -1; -1 -> -2;
-                         */
-                        dnode * x_ = static_cast<dnode*>(y->right);
-                        x = static_cast<dnode*>(x_->left);
-
-                        if (x->h <= 0)
-                        {
-                            x_->h = 0;
-                        } 
-                        else
-                        {
-                            x_->h = -1;
-                        }
-
-                        if (x->h >= 0)
-                        {
-                            x_h = -1;
-                        }
-                        else
-                        {
-                            x_h = -2;
-                        }
-
-                        // std::cout << "RR: " << static_cast<dnode*>(x_)->id << std::endl;
-                        current = static_cast<dnode*>(right_rotate(x_));
-                        DV_CHECKH(x);
-                        // std::cout << visualize(this->root, false);
-                        // std::cout << "x': " << static_cast<dnode*>(x_)->id << std::endl;
+                        x_->h = 0;
+                    }
+                    else
+                    {
+                        x_->h = 1;
                     }
 
-                    // std::cout << "x: " << static_cast<dnode*>(x)->id << std::endl;
-                    // std::cout << "y: " << static_cast<dnode*>(y)->id << std::endl;
-                    
-                    // std::cout << "x_h: " << (int)x_h << std::endl;
-                    y->h = -1 - x_h;
-                    if (x_h <= -1) x->h = 0;
-                    else x->h = 1;
-
-                    // std::cout << "LR: " << static_cast<dnode*>(y)->id << std::endl;
-                    current = static_cast<dnode*>(left_rotate(y));
-                    // x_h = 0 -> x : (h+1, h+1) -> y : (h, h+1) -> y_h = -1; 
-                    // x_h = -1 -> x : (h, h+1) -> y : (h, h) -> y_h = 0; 
-
-                    // std::cout << visualize(this->root);
-                    if (height_change > 0 || x_h == 0)
+                    if (x->h <= 0)
                     {
-                        break;
+                        x_h = 1;
                     }
                     else
                     {
-                        //std::cout << "current changes to: " << current->id << std::endl;
-                        continue;
+                        x_h = 2;
                     }
-                }
-                else if (current->p->h == 2)
-                {
 
-                    current = (dnode*)current->p->left;
-                    /* Left-Left
-                                   y                   x
-                                  / \                 / \
-                                 x   h         ->  h+1   y
-                                / \                     / \
-                          (h+1)  (h,h+1)          (h, h+1) h
-                    */
-
-                    dnode * x = current;
-                    int x_h = current->h;
-                    dnode * y = current->p;
-
-                    //std::cout << "rotate x = " << x->id << std::endl;
-                    //std::cout << "rotate y = " << y->id << std::endl;
+                    left_rotate(x_);
+                }
 
-                    if (current->h < 0)
-                    {
-                        /* Left-Right
-                             y                                               y
-                            / \                                             / \
-                           x'                                              x   h
-                          / \                                             / \
-                        h-1  x                                           x'  a
-                            / \                                         / \       
-                          h-1 h-1    or    h-1  h-2   or   h-2   h-1  h-1  b   
-                           b   a
-                              0               1                 -1
-                              0                0                1
-                          (h-1) - b = -1 -> 0; 1 -> 1; 0 -> 0;
-                          x_h = (max(b, h-1) + 1) - a = h - a
-                          h - a = (0, -1) -> 1; 1 -> 2;
-                        */
-                        dnode * x_ = static_cast<dnode*>(y->left);
-                        x = static_cast<dnode*>(x_->right);
-
-                        if (x->h >= 0)
-                        {
-                            x_->h = 0;
-                            // std::cout << "x: " << static_cast<dnode*>(x)->id << std::endl;
-                            // std::cout << "x->h: " << (int)x->h << std::endl;
-                            // std::cout << "set x'->h: " << (int)x_->h << std::endl;
-                        }
-                        else
-                        {
-                            x_->h = 1;
-                            // std::cout << "x: " << static_cast<dnode*>(x)->id << std::endl;
-                            // std::cout << "x->h: " << (int)x->h << std::endl;
-                            // std::cout << "set x'->h: " << (int)x_->h << std::endl;
-                        }
+                y->h = 1 - x_h;
+                if (x_h >= 1) x->h = 0;
+                else x->h = -1;
+                // x_h = 0 -> x : (h+1, h+1) -> y : (h+1, h) -> y_h = 1; 
+                // x_h = 1 -> x : (h+1, h) -> y : (h, h) -> y_h = 0; 
 
-                        if (x->h <= 0)
-                        {
-                            x_h = 1;
-                        }
-                        else
-                        {
-                            x_h = 2;
-                        }
+                auto top = right_rotate(y);
 
-                        // std::cout << "x': " << static_cast<dnode*>(x_)->id << std::endl;
+                if (height_change > 0 || x_h == 0)
+                {
+                    height_change = 0;
+                }
+                return top;
+            }
+            else
+            {
+                assert((parent->h <= 1) && (parent->h >= -1));
+                return parent;
+            }
+        }
 
-                        // std::cout << "LR: " << static_cast<dnode*>(x_)->id << std::endl;
-                        current = static_cast<dnode*>(left_rotate(x_));
-                        // std::cout << visualize(this->root, false);
-                    }
+        static void _add_upward(NodeBase * subtree, const std::ptrdiff_t count_change, 
+            const std::ptrdiff_t weight_change) noexcept
+        {
+            // Adds the deltas to every ancestor of `subtree`, the shape stays as it is
+            for (Node * parent = subtree->p; parent != nullptr; parent = parent->p)
+            {
+                parent->elem_count = static_cast<Count>(parent->elem_count + count_change);
+                if constexpr (weighted)
+                {
+                    parent->elem_weight = static_cast<Count>(parent->elem_weight + weight_change);
+                }
+            }
+        }
 
-                    y->h = 1 - x_h;
-                    if (x_h >= 1) x->h = 0;
-                    else x->h = -1;
-                    // x_h = 0 -> x : (h+1, h+1) -> y : (h+1, h) -> y_h = 1; 
-                    // x_h = 1 -> x : (h+1, h) -> y : (h, h) -> y_h = 0; 
+        static LeafType * _leftmost(NodeBase * node) noexcept
+        {
+            while (node->type != 'l')
+            {
+                node = static_cast<Node*>(node)->left;
+            }
+            return static_cast<LeafType*>(node);
+        }
 
-                    // std::cout << "x: " << static_cast<dnode*>(x)->id << std::endl;
-                    // std::cout << "y: " << static_cast<dnode*>(y)->id << std::endl;
-                    // std::cout << "x_h: " << x_h << std::endl;
+        static LeafType * _rightmost(NodeBase * node) noexcept
+        {
+            while (node->type != 'l')
+            {
+                node = static_cast<Node*>(node)->right;
+            }
+            return static_cast<LeafType*>(node);
+        }
 
-                    // std::cout << "RR: " << static_cast<dnode*>(y)->id << std::endl;
-                    current = static_cast<dnode*>(right_rotate(y));
+        void _fix_upward(NodeBase * subtree, const std::ptrdiff_t count_change, 
+            const std::ptrdiff_t weight_change, int height_change)
+        {
+            /*
+                `subtree` is already up to date, its element count, weight and
+                height changed by the given amounts. One iterative walk to the
+                root adds the deltas to every ancestor and, with avl_balance,
+                fixes balance factors on the way. Rotations recompute the counts
+                of the nodes they move, so the deltas are added before rotating.
+                The walk stops early once nothing is left to change.
+             */
+            NodeBase * current = subtree;
+            while (current->p != nullptr)
+            {
+                Node * parent = current->p;
+                parent->elem_count = static_cast<Count>(parent->elem_count + count_change);
+                if constexpr (weighted)
+                {
+                    parent->elem_weight = static_cast<Count>(parent->elem_weight + weight_change);
+                }
 
-                    // std::cout << visualize(this->root);
-                    if (height_change > 0 || x_h == 0)
-                    {
-                        break;
-                    }
-                    else
+                if constexpr (avl)
+                {
+                    if (height_change != 0)
                     {
-                        //std::cout << "current changes to: " << current->id << std::endl;
+                        current = _rebalance_step(current, height_change);
                         continue;
                     }
                 }
-                else
+                if (count_change == 0 && (!weighted || weight_change == 0))
                 {
-                    // std::cout << "2. current->p->h == " << (int)current->p->h << std::endl;
-                    //std::cout << visualize(this->root);
-                    assert((current->p->h <= 1) && (current->p->h >= -1));
+                    break;
                 }
-                
-                current_place = '\0';
-                //if (current->p)
-                //    std::cout << "current: " << current->id << " -> " << current->p->id << std::endl;
-                current = current->p;
+                current = parent;
             }
         }
 
-        template<typename R>
+        template<typename R, class Action>
         static
-        R _post_order_traverse(dnode_base * node, const std::function<R(const R &, const R &, dnode_base*)> & action)
+        R _post_order_traverse(NodeBase * node, const Action & action)
         {
-            if (node != nullptr) 
+            /*
+                action(left_result, right_result, node), children first.
+                Iterative: `pending` holds the nodes to visit, and whether their
+                children are already done. `results` holds the finished subtrees.
+             */
+            if (node == nullptr)
+            {
+                return R();
+            }
+            std::vector<std::pair<NodeBase*, bool>> pending{ { node, false } };
+            std::vector<R> results;
+            while (!pending.empty())
             {
-                if (node->type == 'n') 
+                NodeBase * current;
+                bool children_done;
+                std::tie(current, children_done) = pending.back();
+                pending.pop_back();
+                if (current->type == 'l')
                 {
-                    dnode * dn = static_cast<dnode*>(node);
-                    R r1 = _post_order_traverse<R>(dn->left, action);
-                    R r2 = _post_order_traverse<R>(dn->right, action);
-                    return action(r1, r2, node);
+                    results.push_back(action(R(), R(), current));
                 }
-                else if (node->type == 'l')
+                else if (!children_done)
                 {
-                    return action(R(), R(), node);
+                    Node * dn = static_cast<Node*>(current);
+                    pending.emplace_back(current, true);
+                    pending.emplace_back(dn->right, false);
+                    pending.emplace_back(dn->left, false);
                 }
                 else
                 {
-                    assert(false);
+                    R r2 = std::move(results.back());
+                    results.pop_back();
+                    R r1 = std::move(results.back());
+                    results.pop_back();
+                    results.push_back(action(r1, r2, current));
                 }
             }
-            return R();
+            return std::move(results.back());
         }
 
+        template<class Action>
         static
-        void _pre_order_traverse(dnode_base * node, const std::function<void(dnode_base*, int)> & action, int level = 0)
+        void _pre_order_traverse(NodeBase * node, const Action & action, int level = 0)
         {
-            if (node != nullptr)
+            // action(node, level), then the right subtree, then the left one. Iterative
+            if (node == nullptr)
             {
-                if (node->type == 'n')
-                {
-                    dnode * dn = static_cast<dnode*>(node);
-                    action(node, level);
-                    _pre_order_traverse(dn->right, action, level + 1);
-                    _pre_order_traverse(dn->left, action, level + 1);
-                }
-                else if (node->type == 'l')
-                {
-                    action(node, level);
-                }
-                else
+                return;
+            }
+            std::vector<std::pair<NodeBase*, int>> pending{ { node, level } };
+            while (!pending.empty())
+            {
+                NodeBase * current;
+                int current_level;
+                std::tie(current, current_level) = pending.back();
+                pending.pop_back();
+                action(current, current_level);
+                if (current->type == 'n')
                 {
-                    assert(false);
+                    Node * dn = static_cast<Node*>(current);
+                    pending.emplace_back(dn->left, current_level + 1);
+                    pending.emplace_back(dn->right, current_level + 1);
                 }
             }
         }
@@ -671,10 +1799,10 @@ namespace dv
         inline static constexpr bool is_ostreamable_v = is_ostreamable<ElementType>::value;
 
         static
-        std::string visualize(dnode_base * node, bool check = true)
+        std::string visualize(NodeBase * node, bool check = true)
         {
             std::stringstream ss;
-            _pre_order_traverse(node, [&ss](dnode_base* ptr, int level) {
+            _pre_order_traverse(node, [&ss](NodeBase* ptr, int level) {
                 for (int i = 0; i < level; i++)
                 {
                     ss << "  ";
@@ -682,9 +1810,9 @@ namespace dv
                 switch (ptr->type)
                 {
                 case 'n':
-                    assert(static_cast<dnode*>(ptr)->left->p == ptr);
-                    assert(static_cast<dnode*>(ptr)->right->p == ptr);
-                    ss << static_cast<dnode*>(ptr)->id << "(" << (int)static_cast<dnode*>(ptr)->h << ")";
+                    assert(static_cast<Node*>(ptr)->left->p == ptr);
+                    assert(static_cast<Node*>(ptr)->right->p == ptr);
+                    ss << static_cast<Node*>(ptr)->id << "(" << (int)static_cast<Node*>(ptr)->h << ")";
                     break;
                 case 'l':
                     ss << "[";
@@ -710,7 +1838,14 @@ namespace dv
         }
 
         static
-        bool check_height(dnode_base * base, std::function<void()> callback = [](){})
+        bool check_height(NodeBase * base)
+        {
+            return check_height(base, [](){});
+        }
+
+        template<class Callback>
+        static
+        bool check_height(NodeBase * base, const Callback & callback)
         {
             bool good = true;
 
@@ -719,7 +1854,17 @@ namespace dv
                 if (ptr->type == 'l') return 0;
                 else
                 {
-                    auto p = (dnode*)ptr;
+                    auto p = (Node*)ptr;
+                    if (p->count() != p->left->count() + p->right->count())
+                    {
+                        good = false;
+                        //std::cerr << "Count not good. " << std::endl;
+                        throw std::exception();
+                    }
+                    if constexpr (!avl)
+                    {
+                        return std::max(lh, rh) + 1; // No balance factor to check
+                    }
                     if (p->h != lh - rh)
                     {
                         good = false;
@@ -750,9 +1895,52 @@ namespace dv
             return good;
         }
 
+        void _destroy_node(NodeBase * node)
+        {
+            if (node->type == 'l')
+            {
+                this->leaf_destroy(static_cast<LeafType*>(node));
+            }
+            else
+            {
+                this->node_destroy(static_cast<NodeType*>(node));
+            }
+        }
+
+        void _destroy_tree(NodeBase * node) noexcept
+        {
+            /*
+                Iterative and without a stack: descends by unlinking children, 
+                and climbs back through the parent links after freeing a node.
+                Allocates nothing, so it cannot fail.
+             */
+            if (node == nullptr)
+            {
+                return;
+            }
+            NodeBase * stop = node->p;
+            while (node != stop)
+            {
+                if (node->type == 'n')
+                {
+                    auto n = static_cast<Node*>(node);
+                    NodeBase * child = n->left != nullptr ? n->left : n->right;
+                    if (child != nullptr)
+                    {
+                        (n->left != nullptr ? n->left : n->right) = nullptr;
+                        node = child;
+                        continue;
+                    }
+                }
+                NodeBase * parent = node->p;
+                _destroy_node(node);
+                node = parent;
+            }
+        }
+
         ~dvector_base()
         {
-            _post_order_traverse<int>(this->root, [this](int, int, dnode_base* ptr) { this->destroy(ptr); return 0; });
+            _destroy_tree(this->root);
         }
 
     };
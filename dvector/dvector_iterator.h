@@ -8,7 +8,7 @@
 namespace dv
 {
 
-    template<class T, class Allocator = std::allocator<T>>
+    template<class T, class Allocator = std::allocator<T>, class Policy = default_policy>
     class dvector_iterator
     {
         /* RandomAccessIterator for dvector.
@@ -22,16 +22,20 @@ namespace dv
         using pointer = T*;
         using reference = T&;
     DV_PROTECTED:
-        using DvectorBase = dvector_base<T, Allocator>;
+        using DvectorBase = dvector_base<T, Allocator, Policy>;
+        using NodeBase = typename DvectorBase::NodeBase;
+        using Node = typename DvectorBase::Node;
         using Vector = typename DvectorBase::Vector;
         using ElemType = T;
-        using LeafType = dleaf<T, Allocator>;
-        using SliceType = dslice<T, Allocator>;
+        using LeafType = typename DvectorBase::LeafType;
+        using SliceType = typename DvectorBase::SliceType;
     DV_PROTECTED:
-        dnode_base * root;
+        NodeBase * root;
         LeafType * current_leaf;
         size_t current_local_pos;
         size_t current_pos;
+        size_t end_pos = 0; // Elements of the dvector: the counts of its right spine may lag behind
+        T * small_data = nullptr; // Set when iterating the inline elements of a dvector without tree
     DV_PROTECTED:
         void advance(difference_type diff)
         {
@@ -43,27 +47,35 @@ namespace dv
                 2) locate the element using dvector_base::_access_node
              */
 
-            dnode_base * node = current_leaf;
+            if (small_data != nullptr)
+            {
+                current_pos = current_pos + diff;
+                return;
+            }
+
+            NodeBase * node = current_leaf;
 
             if (diff > 0)
             {
+                if (current_pos + diff >= end_pos)
+                {
+                    current_leaf = nullptr; // Indicates we have come to the end
+                    current_local_pos = 0;
+                    current_pos = end_pos;
+                    return;
+                }
+                /*
+                    The target is inside the tree. A node of the right spine holds every
+                    element after its first one, so climbing past it because its count
+                    lags behind only makes the way down longer.
+                 */
                 size_t target_pos = current_local_pos + diff;
-                while (node->count() <= target_pos)
+                while (node->p != nullptr && DvectorBase::_count(node) <= target_pos)
                 {
                     auto old_node = node;
                     node = node->p;
-                    if (node)
-                    {
-                        if (static_cast<dnode*>(node)->is_right_child(old_node))
-                            target_pos += static_cast<dnode*>(node)->left->count();
-                    }
-                    else
-                    {
-                        current_leaf = nullptr; // Indicates we have come to the end
-                        current_local_pos = 0;
-                        current_pos = old_node->count();
-                        return;
-                    }
+                    if (static_cast<Node*>(node)->is_right_child(old_node))
+                        target_pos += DvectorBase::_count(static_cast<Node*>(node)->left);
                 }
 
                 std::tie(current_leaf, current_local_pos) = DvectorBase::_access_node(node, target_pos);
@@ -78,7 +90,7 @@ namespace dv
                     if (old_node == nullptr)
                     {
                         node = root;
-                        target_pos += root->count();
+                        target_pos += end_pos;
                     }
                     else
                     {
@@ -87,8 +99,8 @@ namespace dv
                         {
                             throw std::exception("dvector_iterator out of range. ");
                         }
-                        if (static_cast<dnode*>(node)->is_right_child(old_node))
-                            target_pos += static_cast<dnode*>(node)->left->count();
+                        if (static_cast<Node*>(node)->is_right_child(old_node))
+                            target_pos += DvectorBase::_count(static_cast<Node*>(node)->left);
                     }
                 }
 
@@ -103,11 +115,21 @@ namespace dv
         {
         }
 
-        dvector_iterator(LeafType * current_leaf, dnode_base * root, size_t current_local_pos = 0, size_t current_pos = 0)
+        dvector_iterator(LeafType * current_leaf, NodeBase * root, size_t current_local_pos = 0, size_t current_pos = 0, size_t end_pos = 0)
             : current_leaf(current_leaf),
               root(root),
               current_local_pos(current_local_pos),
-              current_pos(current_pos)
+              current_pos(current_pos),
+              end_pos(end_pos)
+        {
+        }
+
+        dvector_iterator(T * small_data, size_t current_pos)
+            : current_leaf(nullptr),
+              root(nullptr),
+              current_local_pos(0),
+              current_pos(current_pos),
+              small_data(small_data)
         {
         }
 
@@ -156,108 +178,110 @@ namespace dv
         
         const T & operator*() const noexcept
         {
+            if (small_data != nullptr) return small_data[current_pos];
             return current_leaf->value[current_local_pos];
         }
 
         T & operator*() noexcept
         {
+            if (small_data != nullptr) return small_data[current_pos];
             return current_leaf->value[current_local_pos];
         }
 
         const T * operator->() const noexcept
         {
-            return &(current_leaf->value[current_local_pos]);
+            return &(**this);
         }
 
         T * operator->() noexcept
         {
-            return &(current_leaf->value[current_local_pos]);
+            return &(**this);
         }
     };
 
-    template<class T, class Allocator = std::allocator<T>>
+    template<class T, class Allocator = std::allocator<T>, class Policy = default_policy>
     inline bool operator == (
-        const dvector_iterator<T, Allocator> & lhs, 
-        const dvector_iterator<T, Allocator> & rhs) noexcept
+        const dvector_iterator<T, Allocator, Policy> & lhs, 
+        const dvector_iterator<T, Allocator, Policy> & rhs) noexcept
     {
         return lhs.pos() == rhs.pos();
     }
 
-    template<class T, class Allocator = std::allocator<T>>
+    template<class T, class Allocator = std::allocator<T>, class Policy = default_policy>
     inline bool operator != (
-        const dvector_iterator<T, Allocator> & lhs,
-        const dvector_iterator<T, Allocator> & rhs) noexcept
+        const dvector_iterator<T, Allocator, Policy> & lhs,
+        const dvector_iterator<T, Allocator, Policy> & rhs) noexcept
     {
         return lhs.pos() != rhs.pos();
     }
 
-    template<class T, class Allocator = std::allocator<T>>
+    template<class T, class Allocator = std::allocator<T>, class Policy = default_policy>
     inline 
-    dvector_iterator<T, Allocator>
+    dvector_iterator<T, Allocator, Policy>
         operator + (
-            const dvector_iterator<T, Allocator> & iter,
-            const typename dvector_iterator<T, Allocator>::difference_type & diff)
+            const dvector_iterator<T, Allocator, Policy> & iter,
+            const typename dvector_iterator<T, Allocator, Policy>::difference_type & diff)
     {
-        dvector_iterator<T, Allocator> tmp(iter);
+        dvector_iterator<T, Allocator, Policy> tmp(iter);
         tmp.advance(diff);
         return tmp;
     }
 
-    template<class T, class Allocator = std::allocator<T>>
-    inline dvector_iterator<T, Allocator>
+    template<class T, class Allocator = std::allocator<T>, class Policy = default_policy>
+    inline dvector_iterator<T, Allocator, Policy>
         operator + (
-            const typename dvector_iterator<T, Allocator>::difference_type & diff,
-            const dvector_iterator<T, Allocator> & iter)
+            const typename dvector_iterator<T, Allocator, Policy>::difference_type & diff,
+            const dvector_iterator<T, Allocator, Policy> & iter)
     {
         return iter + diff;
     }
 
-    template<class T, class Allocator = std::allocator<T>>
-    inline dvector_iterator<T, Allocator>
+    template<class T, class Allocator = std::allocator<T>, class Policy = default_policy>
+    inline dvector_iterator<T, Allocator, Policy>
         operator - (
-            const dvector_iterator<T, Allocator> & iter,
-            const typename dvector_iterator<T, Allocator>::difference_type & diff)
+            const dvector_iterator<T, Allocator, Policy> & iter,
+            const typename dvector_iterator<T, Allocator, Policy>::difference_type & diff)
     {
         return iter + (-diff);
     }
 
-    template<class T, class Allocator = std::allocator<T>>
-    inline typename dvector_iterator<T, Allocator>::difference_type
+    template<class T, class Allocator = std::allocator<T>, class Policy = default_policy>
+    inline typename dvector_iterator<T, Allocator, Policy>::difference_type
         operator - (
-            const dvector_iterator<T, Allocator> & iter1,
-            const dvector_iterator<T, Allocator> & iter2)
+            const dvector_iterator<T, Allocator, Policy> & iter1,
+            const dvector_iterator<T, Allocator, Policy> & iter2)
     {
         return iter1.pos() - iter2.pos();
     }
 
-    template<class T, class Allocator = std::allocator<T>>
+    template<class T, class Allocator = std::allocator<T>, class Policy = default_policy>
     inline bool operator < (
-        const dvector_iterator<T, Allocator> & lhs,
-        const dvector_iterator<T, Allocator> & rhs)
+        const dvector_iterator<T, Allocator, Policy> & lhs,
+        const dvector_iterator<T, Allocator, Policy> & rhs)
     {
         return lhs.pos() < rhs.pos();
     }
 
-    template<class T, class Allocator = std::allocator<T>>
+    template<class T, class Allocator = std::allocator<T>, class Policy = default_policy>
     inline bool operator > (
-        const dvector_iterator<T, Allocator> & lhs,
-        const dvector_iterator<T, Allocator> & rhs)
+        const dvector_iterator<T, Allocator, Policy> & lhs,
+        const dvector_iterator<T, Allocator, Policy> & rhs)
     {
         return lhs.pos() > rhs.pos();
     }
 
-    template<class T, class Allocator = std::allocator<T>>
+    template<class T, class Allocator = std::allocator<T>, class Policy = default_policy>
     inline bool operator <= (
-        const dvector_iterator<T, Allocator> & lhs,
-        const dvector_iterator<T, Allocator> & rhs)
+        const dvector_iterator<T, Allocator, Policy> & lhs,
+        const dvector_iterator<T, Allocator, Policy> & rhs)
     {
         return lhs.pos() <= rhs.pos();
     }
 
-    template<class T, class Allocator = std::allocator<T>>
+    template<class T, class Allocator = std::allocator<T>, class Policy = default_policy>
     inline bool operator >= (
-        const dvector_iterator<T, Allocator> & lhs,
-        const dvector_iterator<T, Allocator> & rhs)
+        const dvector_iterator<T, Allocator, Policy> & lhs,
+        const dvector_iterator<T, Allocator, Policy> & rhs)
     {
         return lhs.pos() >= rhs.pos();
     }
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstddef>
+
+namespace dv
+{
+    /*
+        Weighers tell a dvector how wide each element is, so that it can
+        translate between element indices and cumulative offsets (e.g. byte
+        or column offsets in a text buffer) in O(log(N)).
+
+        A weigher is a default constructible functor:
+            size_t operator()(const T & e) const;
+
+        `no_weight` disables weighting completely: nothing is cached and
+        no extra work is done on insertion or deletion.
+     */
+
+    struct no_weight
+    {
+    };
+
+    struct unit_weight
+    {
+        template<class T>
+        size_t operator()(const T &) const noexcept
+        {
+            return 1;
+        }
+    };
+
+    struct size_weight
+    {
+        template<class T>
+        size_t operator()(const T & e) const noexcept
+        {
+            return e.size();
+        }
+    };
+
+    template<class Weigher>
+    inline constexpr bool is_weighted_v = true;
+
+    template<>
+    inline constexpr bool is_weighted_v<no_weight> = false;
+}
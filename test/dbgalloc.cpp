@@ -8,9 +8,20 @@ namespace dbgalloc
     size_t stop_no = -1;
     std::map<void *, size_t> ptr_to_no;
     std::map<void *, size_t> ptr_to_size;
+    size_t alloc_count = 0;
+    size_t alloc_bytes = 0;
+    size_t live_bytes = 0;
+    size_t peak_bytes = 0;
 
     void set_exception_on_alloc_no(size_t no)
     {
         stop_no = no;
     }
+
+    void reset_counts()
+    {
+        alloc_count = 0;
+        alloc_bytes = 0;
+        peak_bytes = live_bytes;
+    }
 }
\ No newline at end of file
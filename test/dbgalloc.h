@@ -16,7 +16,14 @@ namespace dbgalloc
     extern std::map<void *, size_t> ptr_to_no;
     extern std::map<void *, size_t> ptr_to_size;
 
+    // Totals since reset_counts(), for profiling: allocations, their bytes, bytes allocated and not freed, and their peak
+    extern size_t alloc_count;
+    extern size_t alloc_bytes;
+    extern size_t live_bytes;
+    extern size_t peak_bytes;
+
     void set_exception_on_alloc_no(size_t no);
+    void reset_counts();
 
     class Dbg
     {
@@ -75,28 +82,33 @@ namespace dbgalloc
             size_t size = cnt * sizeof(value_type);
             void* pMem = nullptr;
 
-            if ((pMem = malloc(sizeof(size_t) + size)) == NULL)
-            {
-                throw std::bad_alloc();
-            }
-
-            *((size_t*)pMem) = size;
-            
             //std::cerr << "alloc_no == " << alloc_no << std::endl;
             //std::cerr << "stop_no == " << stop_no << std::endl;
 
             if (alloc_no == stop_no)
             {
+                // Before malloc, so that nothing leaks when it throws
                 std::stringstream s;
                 s << "alloc exception by dbgalloc::set_exception_on_alloc_no: alloc_no == " << alloc_no << std::endl;
                 std::cerr << s.str();
                 throw std::exception();
             }
 
+            if ((pMem = malloc(sizeof(size_t) + size)) == NULL)
+            {
+                throw std::bad_alloc();
+            }
+
+            *((size_t*)pMem) = size;
+
             pMem = (char*)pMem + sizeof(size_t);
 
             ptr_to_no.emplace(pMem, alloc_no++);
             ptr_to_size.emplace(pMem, size);
+            alloc_count++;
+            alloc_bytes += size;
+            live_bytes += size;
+            peak_bytes = std::max(peak_bytes, live_bytes);
             //std::cout << "allocated : " << no_to_ptr.size() << std::endl;
 
             return reinterpret_cast<pointer>(pMem);
@@ -112,6 +124,7 @@ namespace dbgalloc
                 throw std::exception();
             }
 
+            live_bytes -= ptr_to_size[(void*)p];
             ptr_to_size.erase((void*)p);
             ptr_to_no.erase((void*)p);
             //std::cout << "deallocated : " << no_to_ptr.size() << std::endl;